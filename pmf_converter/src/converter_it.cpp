@@ -102,6 +102,7 @@ struct it_instrument
     pitch_pan_center=0;
     default_pan=0;
     random_vol_var=random_pan_var=0;
+    filter_cutoff=filter_resonance=0;
     mem_zero(note_sample_map, sizeof(note_sample_map));
   }
   //----
@@ -114,6 +115,7 @@ struct it_instrument
   uint8 pitch_pan_center;
   uint8 default_pan;
   uint8 random_vol_var, random_pan_var;
+  uint8 filter_cutoff, filter_resonance;
   note_sample note_sample_map[120];
   envelope envelopes[3];
 };
@@ -299,7 +301,9 @@ e_pmf_error convert_it(bin_input_stream_base &in_file_, pmf_song &song_)
     in_file_>>inst.global_volume;
     in_file_>>inst.default_pan;
     in_file_>>inst.random_vol_var>>inst.random_pan_var;
-    in_file_.skip(0x24);
+    in_file_.skip(0x1e);
+    in_file_>>inst.filter_cutoff>>inst.filter_resonance;
+    in_file_.skip(4);
     in_file_.read_bytes(inst.note_sample_map, 240);
 
     // read instrument envelopes
@@ -476,6 +480,7 @@ e_pmf_error convert_it(bin_input_stream_base &in_file_, pmf_song &song_)
   }
 
   // read patterns
+  bool has_warned_filter_resonance=false;
   for(unsigned pi=0; pi<num_patterns; ++pi)
   {
     unsigned file_offset=pattern_offsets[pi];
@@ -924,6 +929,21 @@ e_pmf_error convert_it(bin_input_stream_base &in_file_, pmf_song &song_)
                 track_row.effect=pmffx_panning;
                 track_row.effect_data=uint8(command_info>2?command_info-128:-126)>>1; // 0=left(-63), 128=center(0), 255=right(63)
               } break;
+
+              // Zxx: MIDI macro (default macro setup: Z00-Z7F=set filter cutoff, Z80-Z8F=set filter resonance)
+              case 26:
+              {
+                if(command_info<0x80)
+                {
+                  track_row.effect=pmffx_subfx;
+                  track_row.effect_data=(pmfsubfx_set_filter_cutoff<<num_subfx_value_bits)+command_info;
+                }
+                else if(!has_warned_filter_resonance)
+                {
+                  warnf("Warning: IT filter resonance effects (Z80-ZFF) not supported\r\n");
+                  has_warned_filter_resonance=true;
+                }
+              } break;
             }
 
             // save latest effect & data
@@ -1012,7 +1032,14 @@ e_pmf_error convert_it(bin_input_stream_base &in_file_, pmf_song &song_)
       // set instrument envelopes
       pmf_inst.fadeout_speed=inst.fadeout*64;
       setup_envelope(pmf_inst.vol_envelope, inst.envelopes[0], envtype_volume);
-      setup_envelope(pmf_inst.pitch_envelope, inst.envelopes[2], envtype_pitch);
+      if(!(inst.envelopes[2].flags&0x80))
+        setup_envelope(pmf_inst.pitch_envelope, inst.envelopes[2], envtype_pitch);
+      else if(inst.envelopes[2].flags&0x1)
+        warnf("Warning: IT filter envelopes not supported - Skipping envelope of instrument #%i\r\n", ii);
+
+      // set instrument filter
+      pmf_inst.filter_cutoff=inst.filter_cutoff;
+      pmf_inst.filter_resonance=inst.filter_resonance;
     }
   }
   else
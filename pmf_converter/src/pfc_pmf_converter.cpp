@@ -41,7 +41,7 @@ using namespace pfc;
 //============================================================================
 // PMF config
 enum {pmf_converter_version=0x0600}; // v0.6
-enum {pmf_file_version=0x1400}; // v1.4
+enum {pmf_file_version=0x1500}; // v1.5
 // PMF file structure
 enum {pmfcfg_offset_signature=PFC_OFFSETOF(pmf_header, signature)};
 enum {pmfcfg_offset_version=PFC_OFFSETOF(pmf_header, version)};
@@ -75,6 +75,11 @@ enum {pmfcfg_offset_smp_loop_length_and_panning=PFC_OFFSETOF(pmf_sample_header,
 enum {pmfcfg_offset_smp_finetune=PFC_OFFSETOF(pmf_sample_header, finetune)};
 enum {pmfcfg_offset_smp_flags=PFC_OFFSETOF(pmf_sample_header, flags)};
 enum {pmfcfg_offset_smp_volume=PFC_OFFSETOF(pmf_sample_header, volume)};
+enum {pmfcfg_sample_pad_pre=3};  // padding bytes before sample data with -pad
+enum {pmfcfg_sample_pad_post=4}; // padding bytes after sample data with -pad (1 without)
+enum {pmfcfg_max_sample_mip_levels=3};   // maximum number of octave-down copies of sample data
+enum {pmfcfg_min_sample_mip_length=16};  // minimum length of sample data & loop in a mip level
+enum {pmfcfg_sample_mip_levels_shift=2}; // shift of the number of mip levels in sample flags
 // PMF instrument config
 enum {pmfcfg_instrument_metadata_size=sizeof(pmf_instrument_header)};
 enum {pmfcfg_offset_inst_vol_env=PFC_OFFSETOF(pmf_instrument_header, vol_env_offset)};
@@ -150,6 +155,9 @@ struct command_arguments
     output_binary=true;
     output_dwords=false;
     enable_data_ref_optim=true;
+    pad_samples=false;
+    max_mip_levels=0;
+    bake_rate=0;
     suppress_copyright=false;
   }
   //----
@@ -161,6 +169,9 @@ struct command_arguments
   bool output_binary;
   bool output_dwords;
   bool enable_data_ref_optim;
+  bool pad_samples;
+  unsigned max_mip_levels;
+  unsigned bake_rate;
   bool suppress_copyright;
 };
 //----
@@ -195,6 +206,9 @@ bool parse_command_arguments(command_arguments &ca_, const char **args_, unsigne
                  "  -hexd           Use dwords instead of bytes for ASCII output\r\n"
                  "  -ch <num_chl>   Maximum number of channels (Default: 64)\r\n"
                  "  -dro            Disable data reference optimizations\r\n"
+                 "  -pad            Pad sample data for cubic/sinc interpolation (PMF_USE_KERNEL_INTERPOLATION)\r\n"
+                 "  -mip <levels>   Add octave-down copies of samples for high notes (PMF_USE_SAMPLE_MIPMAPS, max 3)\r\n"
+                 "  -bake <rate>    Resample samples played only at one pitch to play at 1.0 speed at given rate (Hz)\r\n"
                  "\r\n"
                  "  -h              Print this screen\n"
                  "  -c              Suppress copyright message\r\n", 
@@ -245,6 +259,18 @@ bool parse_command_arguments(command_arguments &ca_, const char **args_, unsigne
           }
         } break;
 
+        case 'b':
+        {
+          // get pitch baking playback rate
+          if(arg_size==5 && i<num_args_-1 && str_ieq(args_[i], "-bake"))
+          {
+            int64 bake_rate=0;
+            if(str_to_int64(bake_rate, args_[i+1]) && bake_rate>=8000 && bake_rate<=65535)
+              ca_.bake_rate=(unsigned)bake_rate;
+            ++i;
+          }
+        } break;
+
         case 'c':
         {
           // suppress copyright text
@@ -265,6 +291,25 @@ bool parse_command_arguments(command_arguments &ca_, const char **args_, unsigne
           if(arg_size==4 && str_ieq(args_[i], "-dro"))
             ca_.enable_data_ref_optim=false;
         } break;
+
+        case 'p':
+        {
+          // pad sample data for interpolation kernels
+          if(arg_size==4 && str_ieq(args_[i], "-pad"))
+            ca_.pad_samples=true;
+        } break;
+
+        case 'm':
+        {
+          // get max sample mip levels
+          if(arg_size==4 && i<num_args_-1 && str_ieq(args_[i], "-mip"))
+          {
+            int64 max_mip_levels=0;
+            if(str_to_int64(max_mip_levels, args_[i+1]) && max_mip_levels>0)
+              ca_.max_mip_levels=max_mip_levels<pmfcfg_max_sample_mip_levels?(unsigned)max_mip_levels:pmfcfg_max_sample_mip_levels;
+            ++i;
+          }
+        } break;
       }
     }
   }
@@ -309,6 +354,129 @@ void write_bits(array<uint8> &comp_data_, unsigned &bit_pos_, unsigned num_bits_
 //----------------------------------------------------------------------------
 
 
+//============================================================================
+// sample data
+//============================================================================
+unsigned num_sample_mip_levels(usize_t len_, usize_t loop_len_, unsigned max_levels_)
+{
+  // number of octave-down copies of the sample that keep enough data for the sample and loop
+  unsigned num_levels=0;
+  while(   num_levels<max_levels_
+        && (len_>>(num_levels+1))>=pmfcfg_min_sample_mip_length
+        && (!loop_len_ || (loop_len_>>(num_levels+1))>=pmfcfg_min_sample_mip_length))
+    ++num_levels;
+  return num_levels;
+}
+//----
+
+PFC_INLINE int8 sample_data_at(const int8 *data_, usize_t len_, usize_t loop_len_, bool bidi_loop_, int64 idx_)
+{
+  // get sample at given index (data beyond the end continues the loop or is silent)
+  if(idx_>=int64(len_) && loop_len_)
+  {
+    int64 loop_pos=(idx_-int64(len_))%int64(loop_len_);
+    idx_=bidi_loop_?int64(len_)-1-loop_pos:int64(len_-loop_len_)+loop_pos;
+  }
+  return idx_>=0 && idx_<int64(len_)?data_[idx_]:0;
+}
+//----
+
+void decimate_sample_data(array<int8> &res_, const int8 *data_, usize_t len_, usize_t loop_len_, bool bidi_loop_)
+{
+  // build half-band low-pass filter (Blackman windowed sinc)
+  enum {num_taps=15};
+  const float pi=3.14159265f;
+  float taps[num_taps], taps_sum=0.0f;
+  for(int ti=0; ti<num_taps; ++ti)
+  {
+    float x=float(ti-num_taps/2);
+    float w=0.42f-0.5f*cos(2.0f*pi*float(ti+1)/float(num_taps+1))+0.08f*cos(4.0f*pi*float(ti+1)/float(num_taps+1));
+    taps[ti]=(x?sin(0.5f*pi*x)/(0.5f*pi*x):1.0f)*w;
+    taps_sum+=taps[ti];
+  }
+
+  // filter and drop every second sample
+  res_.resize(len_>>1);
+  for(usize_t si=0; si<res_.size(); ++si)
+  {
+    float v=0.0f;
+    for(int ti=0; ti<num_taps; ++ti)
+      v+=taps[ti]*float(sample_data_at(data_, len_, loop_len_, bidi_loop_, int64(si*2)+ti-num_taps/2));
+    v=v/taps_sum+(v<0.0f?-0.5f:0.5f);
+    res_[si]=int8(v<-128.0f?-128:v>127.0f?127:int(v));
+  }
+}
+//----
+
+void resample_sample_data(pmf_sample &smp_, float ratio_)
+{
+  // get new sample length and loop (the loop is resampled to whole samples to keep it seamless)
+  usize_t len=smp_.loop_len?smp_.loop_start+smp_.loop_len:smp_.length;
+  bool is_bidi_loop=(smp_.flags&pmfsmpflag_bidi_loop)!=0;
+  usize_t new_loop_start=usize_t(float(smp_.loop_start)/ratio_+0.5f);
+  usize_t new_loop_len=smp_.loop_len?max<usize_t>(1, usize_t(float(smp_.loop_len)/ratio_+0.5f)):0;
+  usize_t new_len=smp_.loop_len?new_loop_start+new_loop_len:max<usize_t>(1, usize_t(float(len)/ratio_+0.5f));
+
+  // resample with Lanczos windowed sinc (cutoff lowered for downsampling)
+  enum {kernel_radius=8};
+  const float pi=3.14159265f;
+  float cutoff=ratio_>1.0f?1.0f/ratio_:1.0f;
+  int64 radius=int64(float(kernel_radius)/cutoff)+1;
+  int8 *new_data=(int8*)PFC_MEM_ALLOC(new_len);
+  const int8 *data=(const int8*)smp_.data.data;
+  for(usize_t si=0; si<new_len; ++si)
+  {
+    float pos=smp_.loop_len && si>=new_loop_start?float(smp_.loop_start)+float(si-new_loop_start)*float(smp_.loop_len)/float(new_loop_len):float(si)*ratio_;
+    int64 pos_int=int64(pos);
+    float v=0.0f, weight_sum=0.0f;
+    for(int64 idx=pos_int-radius+1; idx<=pos_int+radius; ++idx)
+    {
+      float x=(pos-float(idx))*cutoff;
+      if(x<=-float(kernel_radius) || x>=float(kernel_radius))
+        continue;
+      float w=x?float(kernel_radius)*sin(pi*x)*sin(pi*x/float(kernel_radius))/(pi*pi*x*x):1.0f;
+      v+=w*float(sample_data_at(data, len, smp_.loop_len, is_bidi_loop, idx));
+      weight_sum+=w;
+    }
+    v=v/weight_sum+(v<0.0f?-0.5f:0.5f);
+    new_data[si]=int8(v<-128.0f?-128:v>127.0f?127:int(v));
+  }
+
+  // replace the sample data
+  smp_.data=new_data;
+  smp_.length=uint32(new_len);
+  smp_.loop_start=uint32(new_loop_start);
+  smp_.loop_len=uint32(new_loop_len);
+}
+//----
+
+template<class S>
+void write_sample_data(S &out_stream_, const int8 *data_, usize_t len_, usize_t loop_len_, bool bidi_loop_, bool pad_)
+{
+  // write sample with duplicated last sample for linear interpolation
+  const uint8 *data=(const uint8*)data_;
+  if(!pad_)
+  {
+    out_stream_.write_bytes(data, len_);
+    out_stream_<<data[len_-1];
+    return;
+  }
+
+  // pad the sample with silence before the start and with the continuation of the loop (or silence) after the end
+  for(unsigned pi=0; pi<pmfcfg_sample_pad_pre; ++pi)
+    out_stream_<<uint8(0);
+  out_stream_.write_bytes(data, len_);
+  for(unsigned pi=0; pi<pmfcfg_sample_pad_post; ++pi)
+  {
+    uint8 v=0;
+    if(loop_len_)
+      v=bidi_loop_?data[len_-1-(pi%loop_len_)]:data[len_-loop_len_+(pi%loop_len_)];
+    out_stream_<<v;
+  }
+}
+//----------------------------------------------------------------------------
+
+
 //============================================================================
 // pmf_channel
 //============================================================================
@@ -441,6 +609,8 @@ pmf_instrument::pmf_instrument()
   fadeout_speed=65535;
   volume=0xff;
   panning=-128;
+  filter_cutoff=0;
+  filter_resonance=0;
 }
 //----------------------------------------------------------------------------
 
@@ -538,6 +708,7 @@ struct sample_info
     index=0;
     data_offset=0;
     cropped_len=0;
+    num_mip_levels=0;
   }
   //--------------------------------------------------------------------------
 
@@ -545,6 +716,7 @@ struct sample_info
   unsigned index;
   usize_t data_offset;
   usize_t cropped_len;
+  unsigned num_mip_levels;
 };
 //----------------------------------------------------------------------------
 
@@ -566,11 +738,198 @@ PFC_INLINE bool operator<(const comp_type &ct0_, const comp_type &ct1_)
 //----------------------------------------------------------------------------
 
 
+//============================================================================
+// bake_sample_pitches
+//============================================================================
+bool is_pitch_effect(const pmf_pattern_track_row &row_)
+{
+  // check for effects changing the pitch or position of the playing sample
+  switch(row_.effect)
+  {
+    case pmffx_note_slide_down:
+    case pmffx_note_slide_up:
+    case pmffx_note_slide:
+    case pmffx_vibrato:
+    case pmffx_note_vol_slide:
+    case pmffx_vibrato_vol_slide:
+    case pmffx_set_sample_offs: return true;
+    case pmffx_arpeggio: return row_.effect_data!=0;
+    case pmffx_subfx: return (row_.effect_data>>num_subfx_value_bits)==pmfsubfx_set_finetune;
+  }
+  if(row_.volume!=0xff && row_.volume>=pmfvolfx_vol_slide)
+  {
+    uint8 volfx=row_.volume&0xf0;
+    return volfx==pmfvolfx_note_slide_down || volfx==pmfvolfx_note_slide_up || volfx==pmfvolfx_note_slide || volfx==pmfvolfx_vibrato;
+  }
+  return false;
+}
+//----
+
+void get_note_sample(const pmf_song &song_, unsigned inst_idx_, uint8 note_idx_, unsigned &smp_idx_, int &smp_note_idx_)
+{
+  // get the sample and its note played by the instrument for the note
+  smp_idx_=unsigned(-1);
+  smp_note_idx_=note_idx_;
+  if(!song_.instruments.size())
+  {
+    smp_idx_=inst_idx_;
+    return;
+  }
+  const pmf_instrument &inst=song_.instruments[inst_idx_];
+  if(inst.note_map.size())
+  {
+    const pmf_note_map_entry &nme=inst.note_map[note_idx_];
+    if(nme.sample_idx!=0xff)
+    {
+      smp_idx_=nme.sample_idx;
+      smp_note_idx_+=nme.note_idx_offs;
+    }
+  }
+  else
+    smp_idx_=inst.sample_idx;
+}
+//----
+
+void disable_instrument_pitch_baking(const pmf_song &song_, unsigned inst_idx_, array<int> &smp_notes_)
+{
+  for(unsigned ni=0; ni<120; ++ni)
+  {
+    unsigned smp_idx;
+    int smp_note_idx;
+    get_note_sample(song_, inst_idx_, uint8(ni), smp_idx, smp_note_idx);
+    if(smp_idx<smp_notes_.size())
+      smp_notes_[smp_idx]=-2;
+  }
+}
+//----
+
+float note_frequency(const pmf_song &song_, int note_idx_, int16 finetune_)
+{
+  // sample playback frequency of the note (matches pmf_player::get_note_period() & get_sample_speed())
+  if(song_.flags&pmfflag_linear_freq_table)
+  {
+    int note_period=7680-note_idx_*64-finetune_/2;
+    return 8363.0f*8.0f/256.0f*float(pow(2.0, double(7680-note_period)/768.0));
+  }
+  float note_period=float(floor(27392.0/pow(2.0, double(note_idx_*128+finetune_)/(12.0*128.0))+0.5));
+  return 7093789.2f/note_period;
+}
+//----
+
+void bake_sample_pitches(pmf_song &song_, unsigned rate_)
+{
+  // disable baking of samples of instruments with pitch envelopes (sample note: -1=not played, -2=not baked)
+  const unsigned num_channels=(unsigned)song_.channels.size();
+  const usize_t num_samples=song_.samples.size();
+  const usize_t num_virtual_instruments=song_.instruments.size()?song_.instruments.size():num_samples;
+  array<int> smp_notes(num_samples, -1);
+  for(unsigned ii=0; ii<song_.instruments.size(); ++ii)
+    if(song_.instruments[ii].pitch_envelope.data.size())
+      disable_instrument_pitch_baking(song_, ii, smp_notes);
+
+  // check the notes and pitch effects of the samples in played patterns
+  array<uint8> is_pattern_played(song_.patterns.size(), uint8(0));
+  for(unsigned i=0; i<song_.playlist.size(); ++i)
+    is_pattern_played[song_.playlist[i]]=1;
+  array<uint8> chl_smp_refs(num_channels*num_samples, uint8(0));
+  array<uint8> chl_unknown_smp(num_channels, uint8(0));
+  array<unsigned> chl_inst(num_channels), chl_smp(num_channels);
+  for(unsigned pi=0; pi<song_.patterns.size(); ++pi)
+  {
+    if(!is_pattern_played[pi])
+      continue;
+
+    // the instrument and sample of channels are unknown in the beginning of the pattern
+    const pmf_pattern &pattern=song_.patterns[pi];
+    const pmf_pattern_track_row *row=pattern.rows.data();
+    for(unsigned ci=0; ci<num_channels; ++ci)
+    {
+      chl_inst[ci]=unsigned(-1);
+      chl_smp[ci]=unsigned(-1);
+    }
+    for(unsigned ri=0; ri<pattern.num_rows; ++ri)
+      for(unsigned ci=0; ci<num_channels; ++ci, ++row)
+      {
+        // pitch effects disable baking of the playing sample
+        bool is_pitch_fx=is_pitch_effect(*row);
+        if(is_pitch_fx)
+        {
+          if(chl_smp[ci]<num_samples)
+            smp_notes[chl_smp[ci]]=-2;
+          else
+            chl_unknown_smp[ci]=1;
+        }
+
+        // instrument without a note plays the previous note with the new sample
+        if(row->instrument<num_virtual_instruments)
+        {
+          chl_inst[ci]=row->instrument;
+          if(row->note>=120)
+          {
+            disable_instrument_pitch_baking(song_, row->instrument, smp_notes);
+            chl_smp[ci]=unsigned(-1);
+          }
+        }
+
+        // check for single note played for the sample
+        if(row->note<120)
+        {
+          chl_smp[ci]=unsigned(-1);
+          if(chl_inst[ci]>=num_virtual_instruments)
+          {
+            chl_unknown_smp[ci]=1;
+            continue;
+          }
+          unsigned smp_idx;
+          int smp_note_idx;
+          get_note_sample(song_, chl_inst[ci], row->note, smp_idx, smp_note_idx);
+          if(smp_idx<num_samples)
+          {
+            chl_smp[ci]=smp_idx;
+            chl_smp_refs[ci*num_samples+smp_idx]=1;
+            int &smp_note=smp_notes[smp_idx];
+            if(is_pitch_fx || (smp_note!=-1 && smp_note!=smp_note_idx))
+              smp_note=-2;
+            else
+              smp_note=smp_note_idx;
+          }
+        }
+      }
+  }
+
+  // pitch effects of unknown samples disable baking of all samples played on the channel
+  for(unsigned ci=0; ci<num_channels; ++ci)
+    if(chl_unknown_smp[ci])
+      for(unsigned si=0; si<num_samples; ++si)
+        if(chl_smp_refs[ci*num_samples+si])
+          smp_notes[si]=-2;
+
+  // resample the samples played at single pitch to play at speed 1.0 at the given rate
+  unsigned num_baked_samples=0;
+  for(unsigned si=0; si<num_samples; ++si)
+  {
+    pmf_sample &smp=song_.samples[si];
+    if(smp_notes[si]<0 || !smp.length || smp.flags&pmfsmpflag_baked_pitch)
+      continue;
+    resample_sample_data(smp, note_frequency(song_, smp_notes[si], smp.finetune)/float(rate_));
+    smp.finetune=int16(uint16(rate_));
+    smp.flags|=pmfsmpflag_baked_pitch;
+    ++num_baked_samples;
+  }
+  logf("Pitch baked samples: %i (%i Hz)\r\n", num_baked_samples, rate_);
+}
+//----------------------------------------------------------------------------
+
+
 //============================================================================
 // write_pmf_file
 //============================================================================
 void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
 {
+  // resample samples played only at single pitch
+  if(ca_.bake_rate)
+    bake_sample_pitches(song_, ca_.bake_rate);
+
   // get song info
   const unsigned num_channels=(unsigned)song_.channels.size();
   const usize_t num_patterns=song_.patterns.size();
@@ -724,6 +1083,8 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
   // re-index samples and calculate sample data offsets
   unsigned num_active_samples=0;
   usize_t total_sample_data_bytes=0;
+  const usize_t sample_pad_pre=ca_.pad_samples?pmfcfg_sample_pad_pre:0;
+  const usize_t sample_pad_post=ca_.pad_samples?pmfcfg_sample_pad_post:1;
   for(unsigned si=0; si<num_samples; ++si)
   {
     sample_info &sinfo=smp_infos[si];
@@ -731,9 +1092,11 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
     if(sinfo.is_referred || (!ca_.enable_data_ref_optim && !num_instruments && smp.length))
     {
       sinfo.index=num_active_samples++;
-      sinfo.data_offset=total_sample_data_bytes;
+      sinfo.data_offset=total_sample_data_bytes+sample_pad_pre;
       sinfo.cropped_len=smp.loop_len?smp.loop_start+smp.loop_len:smp.length;
-      total_sample_data_bytes+=sinfo.cropped_len+1;
+      sinfo.num_mip_levels=num_sample_mip_levels(sinfo.cropped_len, smp.loop_len, ca_.max_mip_levels);
+      for(unsigned li=0; li<=sinfo.num_mip_levels; ++li)
+        total_sample_data_bytes+=sample_pad_pre+(sinfo.cropped_len>>li)+sample_pad_post;
     }
   }
 
@@ -1141,7 +1504,7 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
   container_output_stream<array<uint8> > out_stream(pmf_data);
   out_stream<<uint32(0x78666d70);  // "pmfx"
   out_stream<<uint16(pmf_file_version);
-  out_stream<<uint16(song_.flags);
+  out_stream<<uint16(song_.flags|(ca_.pad_samples?pmfflag_padded_samples:0));
   out_stream<<uint32(total_file_size);
   out_stream<<uint32(base_offs_sample_metadata);
   out_stream<<uint32(base_offs_instrument_metadata);
@@ -1178,7 +1541,7 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
       out_stream<<uint32(sinfo.cropped_len);
       out_stream<<((uint32(smp.loop_len<sinfo.cropped_len?smp.loop_len:sinfo.cropped_len)&0xffffff)|(uint32(smp.panning)<<24));
       out_stream<<int16(smp.finetune);
-      out_stream<<uint8(smp.flags);
+      out_stream<<uint8(smp.flags|(sinfo.num_mip_levels<<pmfcfg_sample_mip_levels_shift));
       out_stream<<uint8(smp.volume);
     }
   }
@@ -1207,6 +1570,8 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
       out_stream<<uint16(inst.fadeout_speed);
       out_stream<<uint8(inst.volume);
       out_stream<<uint8(inst.panning);
+      out_stream<<uint8(inst.filter_cutoff);
+      out_stream<<uint8(inst.filter_resonance);
       ++num_active_inst;
     }
   }
@@ -1269,8 +1634,20 @@ void write_pmf_file(pmf_song &song_, const command_arguments &ca_)
     usize_t smp_len=smp_infos[si].cropped_len;
     if(smp_len && (!ca_.enable_data_ref_optim || sinfo.is_referred))
     {
-      out_stream.write_bytes(song_.samples[si].data.data, smp_len);
-      out_stream<<((uint8*)song_.samples[si].data.data)[smp_len-1];
+      // write the sample followed by its octave-down copies
+      const pmf_sample &smp=song_.samples[si];
+      const int8 *smp_data=(const int8*)smp.data.data;
+      usize_t loop_len=smp.loop_len<smp_len?smp.loop_len:smp_len;
+      bool is_bidi_loop=(smp.flags&pmfsmpflag_bidi_loop)!=0;
+      write_sample_data(out_stream, smp_data, smp_len, loop_len, is_bidi_loop, ca_.pad_samples);
+      array<int8> mip_data, prev_mip_data;
+      for(unsigned li=1; li<=sinfo.num_mip_levels; ++li)
+      {
+        decimate_sample_data(mip_data, smp_data, smp_len>>(li-1), loop_len>>(li-1), is_bidi_loop);
+        write_sample_data(out_stream, mip_data.data(), mip_data.size(), loop_len>>li, is_bidi_loop, ca_.pad_samples);
+        prev_mip_data.swap(mip_data);
+        smp_data=prev_mip_data.data();
+      }
     }
   }
   out_stream.flush();
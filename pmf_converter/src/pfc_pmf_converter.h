@@ -51,12 +51,15 @@ struct pmf_song;
 enum e_pmf_flags
 {
   pmfflag_linear_freq_table  =0x01,  // 0=Amiga, 1=linear
+  pmfflag_padded_samples     =0x02,  // sample data padded for interpolation kernels
 };
 // PMF sample flags
 enum e_pmf_sample_flags
 {
   pmfsmpflag_16bit      = 0x01,
   pmfsmpflag_bidi_loop  = 0x02,
+  pmfsmpflag_mip_levels = 0x0c, // number of octave-down copies following the sample data (0-3)
+  pmfsmpflag_baked_pitch = 0x10, // sample resampled to play at speed 1.0 at the rate (Hz) stored in place of the finetune
 };
 // PMF special notes
 enum {pmfcfg_note_cut=120};
@@ -95,6 +98,7 @@ enum e_pmf_subfx
   pmfsubfx_pattern_loop,     // [0, 15], 0=set loop start, >0 = loop N times from loop start
   pmfsubfx_note_cut,         // [0, 15], cut on X tick
   pmfsubfx_note_delay,       // [0, 15], delay X ticks
+  pmfsubfx_set_filter_cutoff=8, // [0, 127], sub-effects 8-15 store the upper 3 bits of the resonant filter cutoff
 };
 enum e_pmfx_volslide_type
 {
@@ -203,6 +207,8 @@ struct pmf_instrument_header
   uint16 fadeout_speed;
   uint8 volume;
   int8 panning; // (-127=left, 0=center, 127=right, -128=no pan)
+  uint8 filter_cutoff;    // [0, 127] initial resonant filter cutoff, bit 7 = enabled
+  uint8 filter_resonance; // [0, 127] initial resonant filter resonance, bit 7 = enabled
 };
 //----------------------------------------------------------------------------
 
@@ -305,6 +311,8 @@ struct pmf_instrument
   uint16 fadeout_speed;
   uint8 volume;
   int8 panning;
+  uint8 filter_cutoff;    // bit 7 = enabled
+  uint8 filter_resonance; // bit 7 = enabled
   pmf_envelope vol_envelope;
   pmf_envelope pitch_envelope;
   array<pmf_note_map_entry> note_map;
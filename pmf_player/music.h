@@ -2,8 +2,8 @@
 //    Length: 42
 //  Channels: 12
 //      Size: 9112 bytes
-//  Exporter: PMF Converter v0.6 (PMF v1.4)
-0x70, 0x6d, 0x66, 0x78, 0x00, 0x14, 0x00, 0x00, 0x98, 0x23, 0x00, 0x00, 0x68, 0x00, 0x00, 0x00, 0xe8, 0x00, 0x00, 0x00, 0xe8, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x02, 0x5f, 0x1c, 0x00, 0x00, 0x6b, 0x2a, 0x00, 0x0c, 0x0c, 0x00, 0x08, 0x03, 0x02, 0x04, 0x04, 0x05, 0x05, 0x06, 0x06, 0x08, 0x09, 0x0a, 0x0b, 0x00, 0x01, 0x00, 0x01, 0x07, 0x05, 0x07, 0x05, 0x06, 0x06, 0x0a, 0x0b, 0x0a, 0x0b, 0x08, 0x09, 0x08, 0x09, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x07, 0x06, 0x06, 0x06, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0x00, 0x00, 0x85, 0x0f, 0x00, 0x00, 0xae, 0x00, 0x00, 0x00, 0xa7, 0x00, 0x00, 0x80, 0x76, 0x0e, 0x00, 0xff, 0x34, 0x10, 0x00, 0x00, 0xad, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00, 0x80, 0x84, 0x0e, 0x00, 0xff, 0xe2, 0x10, 0x00, 0x00, 0x69, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xdc, 0xfd, 0x00, 0xff, 0x4c, 0x14, 0x00, 0x00, 0xb6, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xfa, 0x00, 0x00, 0xb4, 0x03, 0x18, 0x00, 0x00, 0xb2, 0x03, 0x00, 0x00, 0xab, 0x03, 0x00, 0x80, 0xb2, 0x04, 0x00, 0xc8, 0xb6, 0x1b, 0x00, 0x00, 0xae, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xbe, 0xfa, 0x00, 0xc8, 0x65, 0x1f, 0x00, 0x00, 0x84, 0x03, 0x00, 0x00, 0x7a, 0x03, 0x00, 0x80, 0x65, 0x08, 0x00, 0xff, 0xea, 0x22, 0x00, 0x00, 0xad, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00, 0x80, 0x66, 0x0e, 0x00, 0xa0, 0x3f, 0x00, 0x20, 0x02, 0x5c, 0x02, 0x98, 0x02, 0xd5, 0x02, 0x12, 0x03, 0x61, 0x03, 0xb3, 0x03, 0xff, 0x03, 0x2b, 0x04, 0x7f, 0x04, 0xd3, 0x04, 
+//  Exporter: PMF Converter v0.6 (PMF v1.5)
+0x70, 0x6d, 0x66, 0x78, 0x00, 0x15, 0x00, 0x00, 0x98, 0x23, 0x00, 0x00, 0x68, 0x00, 0x00, 0x00, 0xe8, 0x00, 0x00, 0x00, 0xe8, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x02, 0x5f, 0x1c, 0x00, 0x00, 0x6b, 0x2a, 0x00, 0x0c, 0x0c, 0x00, 0x08, 0x03, 0x02, 0x04, 0x04, 0x05, 0x05, 0x06, 0x06, 0x08, 0x09, 0x0a, 0x0b, 0x00, 0x01, 0x00, 0x01, 0x07, 0x05, 0x07, 0x05, 0x06, 0x06, 0x0a, 0x0b, 0x0a, 0x0b, 0x08, 0x09, 0x08, 0x09, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x07, 0x06, 0x06, 0x06, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0xc4, 0x4c, 0x00, 0x00, 0x85, 0x0f, 0x00, 0x00, 0xae, 0x00, 0x00, 0x00, 0xa7, 0x00, 0x00, 0x80, 0x76, 0x0e, 0x00, 0xff, 0x34, 0x10, 0x00, 0x00, 0xad, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00, 0x80, 0x84, 0x0e, 0x00, 0xff, 0xe2, 0x10, 0x00, 0x00, 0x69, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xdc, 0xfd, 0x00, 0xff, 0x4c, 0x14, 0x00, 0x00, 0xb6, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xfa, 0x00, 0x00, 0xb4, 0x03, 0x18, 0x00, 0x00, 0xb2, 0x03, 0x00, 0x00, 0xab, 0x03, 0x00, 0x80, 0xb2, 0x04, 0x00, 0xc8, 0xb6, 0x1b, 0x00, 0x00, 0xae, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xbe, 0xfa, 0x00, 0xc8, 0x65, 0x1f, 0x00, 0x00, 0x84, 0x03, 0x00, 0x00, 0x7a, 0x03, 0x00, 0x80, 0x65, 0x08, 0x00, 0xff, 0xea, 0x22, 0x00, 0x00, 0xad, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00, 0x80, 0x66, 0x0e, 0x00, 0xa0, 0x3f, 0x00, 0x20, 0x02, 0x5c, 0x02, 0x98, 0x02, 0xd5, 0x02, 0x12, 0x03, 0x61, 0x03, 0xb3, 0x03, 0xff, 0x03, 0x2b, 0x04, 0x7f, 0x04, 0xd3, 0x04, 
 0xdf, 0x04, 0x3f, 0x00, 0xeb, 0x04, 0x2a, 0x05, 0x69, 0x05, 0xa9, 0x05, 0xe9, 0x05, 0x61, 0x03, 0xb3, 0x03, 0xff, 0x03, 0x38, 0x06, 0x8c, 0x06, 0xe0, 0x06, 0xec, 0x06, 0x3f, 0x00, 0xf8, 0x06, 0x0f, 0x07, 0x26, 0x07, 0x32, 0x07, 0x3f, 0x07, 0x68, 0x07, 0x90, 0x07, 0xb4, 0x07, 0xcd, 0x07, 0xe6, 0x07, 0x23, 0x08, 0x5f, 0x08, 0x3f, 0x00, 0x9b, 0x08, 0xd7, 0x08, 0x13, 0x09, 0x2c, 0x09, 0x47, 0x09, 0x6b, 0x09, 0x8f, 0x09, 0xa3, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0x3f, 0x00, 0xc0, 0x09, 0xd7, 0x09, 0x26, 0x07, 0x32, 0x07, 0xee, 0x09, 0x61, 0x03, 0xb6, 0x09, 0xff, 0x03, 0xb6, 0x09, 0xb6, 0x09, 0x01, 0x0a, 0x18, 0x0a, 0x3f, 0x00, 0x2f, 0x0a, 0xc0, 0x09, 0x71, 0x0a, 0x88, 0x0a, 0xa1, 0x0a, 0x61, 0x03, 0xd8, 0x0a, 0xff, 0x03, 0x24, 0x0b, 0x76, 0x0b, 0x01, 0x0a, 0x18, 0x0a, 0x3f, 0x00, 0x2f, 0x0a, 0xb6, 0x09, 0xc8, 0x0b, 0xc8, 0x0b, 0xa1, 0x0a, 0x61, 0x03, 0xb3, 0x03, 0xff, 0x03, 0x24, 0x0b, 0x76, 0x0b, 0x01, 0x0a, 0x18, 0x0a, 0x3f, 0x00, 0x2f, 0x0a, 0xdc, 0x0b, 0x00, 0x0c, 0x0b, 0x0c, 0xee, 0x09, 0x61, 0x03, 0xb3, 0x03, 0xff, 0x03, 0x24, 0x0b, 0x76, 0x0b, 0x01, 0x0a, 0x18, 0x0a, 0x3f, 0x00, 0x18, 0x0c, 0x54, 0x0c, 0x90, 0x0c, 0xcc, 0x0c, 0x08, 0x0d, 0x43, 0x0d, 0x57, 0x0d, 0x72, 0x0d, 0x8c, 0x0d, 0xa6, 0x0d, 0xd0, 0x0d, 0xeb, 0x0d, 0x3f, 0x00, 0x06, 0x0e, 0x45, 0x0e, 0x84, 0x0e, 0xc4, 0x0e, 0x04, 0x0f, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0x3f, 0x00, 0x18, 0x0c, 0x54, 0x0c, 0x98, 0x02, 0xd5, 0x02, 0x44, 0x0f, 0x61, 0x03, 0xee, 0x09, 0xff, 0x03, 0xb6, 0x09, 
 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0x3f, 0x00, 0x06, 0x0e, 0x45, 0x0e, 0x84, 0x0e, 0xc4, 0x0e, 0x04, 0x0f, 0x61, 0x03, 0xee, 0x09, 0xff, 0x03, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xb6, 0x09, 0xd6, 0x00, 0x0f, 0xa0, 0x10, 0x52, 0x04, 0xe0, 0x30, 0x8a, 0x09, 0xa8, 0x90, 0x21, 0x92, 0x36, 0x88, 0x43, 0x24, 0x2d, 0x0c, 0x79, 0x14, 0xc3, 0x3e, 0x26, 0x05, 0x54, 0xc8, 0x0f, 0x61, 0x17, 0xc3, 0xa7, 0x80, 0x0a, 0x99, 0x51, 0x4c, 0x40, 0x85, 0x18, 0xf1, 0x84, 0x44, 0x34, 0xe2, 0x69, 0x67, 0xf8, 0xa3, 0x18, 0x0e, 0xf2, 0x29, 0xa0, 0x42, 0x86, 0x38, 0x03, 0xd6, 0x00, 0x2f, 0xa0, 0x10, 0x52, 0x04, 0xe0, 0x30, 0x8a, 0x09, 0xa8, 0x90, 0x21, 0x92, 0x36, 0x88, 0x43, 0x24, 0x2d, 0x0c, 0x79, 0x14, 0xc3, 0x3e, 0x26, 0x05, 0x54, 0xc8, 0x0f, 0x61, 0x17, 0xc3, 0xa7, 0x80, 0x0a, 0x99, 0x51, 0x4c, 0x40, 0x85, 0x18, 0xf1, 0x84, 0x44, 0x34, 0xe2, 0x69, 0x67, 0xf8, 0xa3, 0x18, 0x0e, 0xf2, 0x29, 0xa0, 0x42, 0x86, 0x38, 0x03, 0x16, 0x81, 0xd2, 0xc1, 0x30, 0xb0, 0x28, 0xcc, 0x15, 0xd1, 0x3c, 0x26, 0x39, 0x8c, 0xe2, 0x2e, 0x6c, 0x88, 0xa4, 0x88, 0x0e, 0xf2, 0x90, 0x49, 0x0e, 0x63, 0x1e, 0xc5, 0x51, 0x98, 0x0f, 0x49, 0x11, 0xfd, 0x63, 0x98, 0xc5, 0x51, 0xd8, 0x29, 0xa2, 0x67, 0x14, 0x77, 0x61, 0x46, 0x3c, 0x21, 0x11, 0x8d, 0x78, 0x8a, 0xe8, 0x19, 0xff, 0x28, 0x8e, 0xc2, 0x82, 0x78, 0x02, 0x16, 0x81, 0xd2, 0xc1, 0x10, 0xb0, 0x28, 0xcc, 0x15, 0xd1, 0x3c, 0x26, 0x39, 0x8c, 0xe2, 0x2e, 0x6c, 0x88, 0xa4, 0x88, 0x0e, 0xf2, 0x90, 0x49, 0x0e, 0x63, 0x1e, 0xc5, 0x51, 0x98, 0x0f, 0x49, 0x11, 0xfd, 0x63, 0x98, 0xc5, 0x51, 0xd8, 0x29, 0xa2, 0x67, 0x14, 
 0x77, 0x61, 0x46, 0x3c, 0x21, 0x11, 0x8d, 0x78, 0x8a, 0xe8, 0x19, 0xff, 0x28, 0x8e, 0xc2, 0x82, 0x78, 0x02, 0xd6, 0xc0, 0x50, 0xe8, 0xc0, 0x05, 0x80, 0x11, 0x3c, 0xd5, 0x11, 0x5d, 0x40, 0x1d, 0xf1, 0x82, 0x06, 0x86, 0x42, 0x67, 0xa4, 0x80, 0x86, 0xd1, 0xdd, 0x9d, 0x0d, 0x83, 0x99, 0x14, 0x50, 0x67, 0x41, 0x1c, 0x22, 0xa9, 0x98, 0x61, 0xcc, 0xa3, 0x3b, 0x3a, 0xf3, 0x15, 0x32, 0x9c, 0x14, 0x50, 0x67, 0x3f, 0x84, 0xdd, 0x5d, 0x21, 0xc3, 0xce, 0x4e, 0x01, 0x3d, 0xa3, 0xbb, 0x3b, 0x33, 0x16, 0x32, 0xfc, 0xc4, 0x44, 0x36, 0xf2, 0xc9, 0xe1, 0x33, 0xfe, 0xd1, 0x1d, 0x9d, 0x05, 0x01, 0xd6, 0x80, 0x50, 0xa0, 0x83, 0x21, 0x21, 0x44, 0x40, 0x04, 0xb2, 0x37, 0xb5, 0xd2, 0x0c, 0xd1, 0x08, 0x11, 0x10, 0x81, 0xec, 0x4d, 0xad, 0x34, 0x43, 0x34, 0x42, 0x04, 0x44, 0x20, 0x7b, 0x53, 0x2b, 0xcd, 0x10, 0x8d, 0x10, 0x01, 0x11, 0xc8, 0xde, 0xd4, 0x4a, 0x33, 0x44, 0x23, 0x44, 0x40, 0x04, 0xb2, 0x37, 0xb5, 0xd2, 0x0c, 0xd1, 0x08, 0x11, 0x10, 0x81, 0xec, 0x4d, 0xad, 0x34, 0x43, 0x34, 0x42, 0x04, 0x44, 0x20, 0x7b, 0x53, 0x2b, 0xcd, 0x10, 0x8d, 0x10, 0x01, 0x11, 0xc8, 0xde, 0xd4, 0x0a, 0xd6, 0xc3, 0xb1, 0x58, 0x5a, 0x80, 0x38, 0x90, 0x06, 0x20, 0x4a, 0x03, 0x07, 0x82, 0x21, 0x0e, 0xae, 0x03, 0x88, 0xf3, 0x42, 0x87, 0x97, 0x16, 0x60, 0xa4, 0x01, 0x88, 0xd2, 0xc0, 0x81, 0x60, 0x88, 0x83, 0xeb, 0x00, 0xe2, 0xbc, 0xd0, 0xe1, 0xa5, 0x05, 0x18, 0x69, 0x00, 0xa2, 0x34, 0x70, 0x20, 0x18, 0xe2, 0xe0, 0x3a, 0x80, 0x38, 0x2f, 0x74, 0x78, 0x69, 0x01, 0x46, 0x1a, 0x80, 0x28, 0x0d, 0x1c, 0x08, 0x86, 0x38, 0xb8, 0x0e, 0x20, 0xca, 0x0b, 0x1d, 0x00, 0xd6, 
@@ -70,6 +70,19 @@ struct pmf_instrument_header
   uint16_t fadeout_speed;
   uint8_t volume;
   int8_t panning;
+  uint8_t filter_cutoff;    // [0, 127] initial resonant filter cutoff, bit 7 = enabled
+  uint8_t filter_resonance; // [0, 127] initial resonant filter resonance, bit 7 = enabled
+};
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// e_pmf_flags
+//============================================================================
+enum e_pmf_flags
+{
+  pmfflag_linear_freq_table  =0x01,  // 0=Amiga, 1=linear
+  pmfflag_padded_samples     =0x02,  // sample data padded for interpolation kernels (pmfcfg_sample_pad_pre/post bytes around each sample)
 };
 //----------------------------------------------------------------------------
 
@@ -81,6 +94,8 @@ enum e_pmf_sample_flags
 {
   pmfsmpflag_16bit      = 0x01,
   pmfsmpflag_bidi_loop  = 0x02,
+  pmfsmpflag_mip_levels = 0x0c, // number of octave-down copies following the sample data (0-3)
+  pmfsmpflag_baked_pitch = 0x10, // sample resampled to play at speed 1.0 at the rate (Hz) stored in place of the finetune
 };
 //----------------------------------------------------------------------------
 
@@ -95,6 +110,9 @@ enum {pmfcfg_offset_smp_loop_length_and_panning=PFC_OFFSETOF(pmf_sample_header,
 enum {pmfcfg_offset_smp_finetune=PFC_OFFSETOF(pmf_sample_header, finetune)};
 enum {pmfcfg_offset_smp_flags=PFC_OFFSETOF(pmf_sample_header, flags)};
 enum {pmfcfg_offset_smp_volume=PFC_OFFSETOF(pmf_sample_header, volume)};
+enum {pmfcfg_sample_pad_pre=3};  // padding bytes before sample data with pmfflag_padded_samples
+enum {pmfcfg_sample_pad_post=4}; // padding bytes after sample data with pmfflag_padded_samples (1 without)
+enum {pmfcfg_sample_mip_levels_shift=2}; // shift of pmfsmpflag_mip_levels
 //----------------------------------------------------------------------------
 
 
@@ -108,6 +126,8 @@ enum {pmfcfg_offset_inst_pitch_env=PFC_OFFSETOF(pmf_instrument_header, pitch_env
 enum {pmfcfg_offset_inst_fadeout_speed=PFC_OFFSETOF(pmf_instrument_header, fadeout_speed)};
 enum {pmfcfg_offset_inst_volume=PFC_OFFSETOF(pmf_instrument_header, volume)};
 enum {pmfcfg_offset_inst_panning=PFC_OFFSETOF(pmf_instrument_header, panning)};
+enum {pmfcfg_offset_inst_filter_cutoff=PFC_OFFSETOF(pmf_instrument_header, filter_cutoff)};
+enum {pmfcfg_offset_inst_filter_resonance=PFC_OFFSETOF(pmf_instrument_header, filter_resonance)};
 //----------------------------------------------------------------------------
 
 //============================================================================
@@ -28,6 +28,15 @@
 //============================================================================
 
 #include "pmf_player.h"
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+#if PMF_USE_KERNEL_INTERPOLATION!=4 && PMF_USE_KERNEL_INTERPOLATION!=8
+#error Kernel interpolation (PMF_USE_KERNEL_INTERPOLATION) must be 0, 4 or 8
+#endif
+#if defined(ARDUINO) && !defined(__IMXRT1062__)
+#error Kernel interpolation (PMF_USE_KERNEL_INTERPOLATION) is supported only on host and Teensy 4
+#endif
+#include <math.h>
+#endif
 //---------------------------------------------------------------------------
 
 
@@ -64,7 +73,7 @@ struct pmf_header
 // PMF format config
 //===========================================================================
 // PMF config
-enum {pmf_file_version=0x1400}; // v1.4
+enum {pmf_file_version=0x1500}; // v1.5
 // PMF file structure
 enum {pmfcfg_offset_signature=PFC_OFFSETOF(pmf_header, signature)};
 enum {pmfcfg_offset_version=PFC_OFFSETOF(pmf_header, version)};
@@ -115,11 +124,6 @@ enum {pmfcfg_num_instrument_bits=6}; // max 64 instruments
 enum {pmfcfg_num_volume_bits=6};     // volume range [0, 63]
 enum {pmfcfg_num_effect_bits=4};     // effects 0-15
 enum {pmfcfg_num_effect_data_bits=8};
-// PMF flags
-enum e_pmf_flags
-{
-  pmfflag_linear_freq_table  =0x01,  // 0=Amiga, 1=linear
-};
 // PMF special notes
 enum {pmfcfg_note_cut=120};
 enum {pmfcfg_note_off=121};
@@ -171,6 +175,13 @@ static const int8_t PROGMEM s_waveforms[3][32]=
   {-2, -6, -10, -14, -18, -22, -26, -30, -34, -38, -42, -46, -50, -54, -58, -62, -66, -70, -74, -78, -82, -86, -90, -94, -98, -102, -106, -110, -114, -118, -122, -126}, // ramp down-wave
   {127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127}, // square-wave
 };
+#if PMF_USE_RESONANT_FILTERS==1
+// resonant filter cutoff frequencies of the lowest octave (110*2^(0.25+cutoff/24) Hz, 8.8 fp)
+static const uint16_t PROGMEM s_filter_cutoff_freqs[24]=
+{
+  33488, 34469, 35479, 36519, 37589, 38691, 39824, 40991, 42192, 43429, 44701, 46011, 47359, 48747, 50175, 51646, 53159, 54717, 56320, 57970, 59669, 61417, 63217, 65069
+};
+#endif
 //---------------------------------------------------------------------------
 
 
@@ -229,6 +240,29 @@ namespace
       res*=1.4142135623730950488f;
     return res;
   }
+  //-------------------------------------------------------------------------
+
+#if PMF_USE_CHANNEL_METERS==1
+  //=========================================================================
+  // isqrt
+  //=========================================================================
+  uint8_t isqrt(uint16_t x_)
+  {
+    // bitwise integer square root (rounded down)
+    uint16_t res=0;
+    for(uint16_t bit=1<<14; bit; bit>>=2)
+    {
+      if(x_>=res+bit)
+      {
+        x_-=res+bit;
+        res=(res>>1)+bit;
+      }
+      else
+        res>>=1;
+    }
+    return uint8_t(res);
+  }
+#endif
 } // namespace <anonymous>
 //---------------------------------------------------------------------------
 
@@ -236,19 +270,82 @@ namespace
 //===========================================================================
 // pmf_player
 //===========================================================================
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+int16_t pmf_player::s_interpolation_kernel[256][PMF_USE_KERNEL_INTERPOLATION];
+#endif
+//----
+
 pmf_player::pmf_player()
 {
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+  init_interpolation_kernel();
+#endif
   m_pmf_file=0;
   m_sampling_freq=0;
   m_row_callback=0;
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  m_batch_row_callback=0;
+#endif
   m_tick_callback=0;
+  m_song_end_callback=0;
+  m_next_pmf_file=0;
+  m_mix_pmf_file=0;
+  m_is_mix_stopped=false;
+  m_channel_mute_mask=0;
+  m_channel_solo_mask=0;
+  m_sequencer_thread=false;
+  m_layer_owner=0;
+  m_next_layer=0;
+#if !defined(ARDUINO)
+  m_host_mixer=0;
+#endif
+  m_num_pattern_channels=0;
+  m_num_playback_channels=0;
+  m_num_sfx_channels=0;
+  m_sfx_queue_write_count=0;
+  m_sfx_queue_read_count=0;
+  m_sfx_start_count=0;
+  m_command_queue_write_count=0;
+  m_command_queue_read_count=0;
+#if PMF_USE_STATE_SNAPSHOTS==1
+  memset(m_states, 0, sizeof(m_states));
+  m_state_seq=0;
+#endif
+  m_master_volume=m_master_fade_target=uint32_t(1)<<24;
+  m_master_fade_step=0;
+  m_master_gain=256;
+  m_tempo_scale=256;
+  m_pitch_scale=256;
+#if PMF_USE_QUALITY_GOVERNOR==1
+  m_quality_level=0;
+  m_quality_drop_mask=0;
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+  memset(m_channel_level_peaks, 0, sizeof(m_channel_level_peaks));
+  memset(m_channel_level_rms, 0, sizeof(m_channel_level_rms));
+#endif
+#if PMF_USE_ECHO==1
+  m_echo_buffer=0;
+  m_echo_pos=0;
+  m_echo_feedback=0;
+  m_echo_level=0;
+  memset(m_echo_sends, 0, sizeof(m_echo_sends));
+#endif
   m_speed=0;
+  m_song_end_action=pmfsongend_loop;
+  m_is_song_end_pending=false;
+  m_is_song_stopped=false;
 }
 //----
 
 pmf_player::~pmf_player()
 {
+  if(m_layer_owner)
+    m_layer_owner->detach_layer(*this);
   stop();
+#if !defined(ARDUINO)
+  release_host_mixer();
+#endif
 }
 //----
 
@@ -256,26 +353,43 @@ void pmf_player::load(const void *pmem_pmf_file_)
 {
   // check for valid PMF file
   const uint8_t *pmf_file=static_cast<const uint8_t*>(pmem_pmf_file_);
-  if(pgm_read_dword(pmf_file+pmfcfg_offset_signature)!=0x78666d70)
+  if(!is_valid_pmf_file(pmf_file))
+    return;
+
+  // read PMF properties
+  init_pmf_file(pmf_file);
+  m_mix_pmf_file=pmf_file;
+  enable_playback_channels(m_num_pattern_channels);
+  PMF_SERIAL_LOG("PMF file loaded (%i channels)\r\n", m_num_pattern_channels);
+}
+//----
+
+bool pmf_player::is_valid_pmf_file(const uint8_t *pmf_file_)
+{
+  // check PMF file signature and version
+  if(pgm_read_dword(pmf_file_+pmfcfg_offset_signature)!=0x78666d70)
   {
     PMF_SERIAL_LOG("Error: Invalid PMF file. Please use pmf_converter to generate the file.\r\n");
-    return;
+    return false;
   }
-  if((pgm_read_word(pmf_file+pmfcfg_offset_version)&0xfff0)!=pmf_file_version)
+  if((pgm_read_word(pmf_file_+pmfcfg_offset_version)&0xfff0)!=pmf_file_version)
   {
     PMF_SERIAL_LOG("Error: PMF file version mismatch. Please use matching pmf_converter to generate the file.\r\n");
-    return;
+    return false;
   }
+  return true;
+}
+//----
 
+void pmf_player::init_pmf_file(const uint8_t *pmf_file_)
+{
   // read PMF properties
-  m_pmf_file=pmf_file;
+  m_pmf_file=pmf_file_;
   m_num_pattern_channels=pgm_read_byte(m_pmf_file+pmfcfg_offset_num_channels);
   m_num_instruments=pgm_read_byte(m_pmf_file+pmfcfg_offset_num_instruments);
   m_num_samples=pgm_read_byte(m_pmf_file+pmfcfg_offset_num_samples);
-  enable_playback_channels(m_num_pattern_channels);
   m_pmf_flags=pgm_read_word(m_pmf_file+pmfcfg_offset_flags);
   m_note_slide_speed=m_pmf_flags&pmfflag_linear_freq_table?4:2;
-  PMF_SERIAL_LOG("PMF file loaded (%i channels)\r\n", m_num_pattern_channels);
 }
 //----
 
@@ -283,6 +397,16 @@ void pmf_player::enable_playback_channels(uint8_t num_channels_)
 {
   if(m_pmf_file)
     m_num_playback_channels=num_channels_<pmfplayer_max_channels?num_channels_:pmfplayer_max_channels;
+  m_num_sfx_channels=min(m_num_sfx_channels, m_num_playback_channels);
+  m_num_processed_pattern_channels=min(m_num_pattern_channels, uint8_t(m_num_playback_channels-m_num_sfx_channels));
+}
+//----
+
+void pmf_player::enable_sfx_channels(uint8_t num_channels_)
+{
+  // reserve the last playback channels for play_sfx() (enable the extra playback channels first)
+  m_num_sfx_channels=min(num_channels_, m_num_playback_channels);
+  m_num_processed_pattern_channels=min(m_num_pattern_channels, uint8_t(m_num_playback_channels-m_num_sfx_channels));
 }
 //----
 
@@ -293,11 +417,119 @@ void pmf_player::set_row_callback(pmf_row_callback_t callback_, void *custom_dat
 }
 //----
 
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+void pmf_player::set_batch_row_callback(pmf_batch_row_callback_t callback_, void *custom_data_, pmf_channel_mask_t interest_mask_)
+{
+  // the callback is called only for rows with data on the channels of the interest mask
+  m_batch_row_callback=callback_;
+  m_batch_row_callback_custom_data=custom_data_;
+  m_batch_row_interest_mask=interest_mask_;
+}
+//----
+#endif
+
 void pmf_player::set_tick_callback(pmf_tick_callback_t callback_, void *custom_data_)
 {
   m_tick_callback=callback_;
   m_tick_callback_custom_data=custom_data_;
 }
+//----
+
+void pmf_player::set_song_end_callback(pmf_song_end_callback_t callback_, void *custom_data_)
+{
+  // the callback is called on the sequencer when the song ends or loops back (set_next_song() can be called from the callback)
+  m_song_end_callback=callback_;
+  m_song_end_callback_custom_data=custom_data_;
+}
+//----
+
+void pmf_player::set_song_end_action(e_pmf_song_end_action action_)
+{
+  m_song_end_action=uint8_t(action_);
+}
+//----
+
+void pmf_player::set_channel_mute_mask(pmf_channel_mask_t channel_mask_)
+{
+  // muted channels are sequenced normally but not mixed to the output
+  m_channel_mute_mask=channel_mask_;
+}
+//----
+
+void pmf_player::set_channel_solo_mask(pmf_channel_mask_t channel_mask_)
+{
+  // if any channel is soloed, only the soloed channels are mixed to the output (0=no solo)
+  m_channel_solo_mask=channel_mask_;
+}
+//----
+
+void pmf_player::set_master_volume(uint8_t volume_)
+{
+  // set master volume immediately (255=full) and stop fading
+  m_master_volume=m_master_fade_target=uint32_t(volume_+(volume_>>7))<<16;
+  m_master_fade_step=0;
+  m_master_gain=uint16_t(m_master_volume>>16);
+}
+//----
+
+void pmf_player::fade_to(uint8_t volume_, uint16_t duration_ms_)
+{
+  // fade master volume linearly to the target volume in given time (applied per mixed batch of samples)
+  uint32_t num_fade_samples=(uint32_t(duration_ms_)*m_sampling_freq)/1000;
+  if(!num_fade_samples)
+  {
+    set_master_volume(volume_);
+    return;
+  }
+  m_master_fade_target=uint32_t(volume_+(volume_>>7))<<16;
+  int32_t step=(int32_t(m_master_fade_target)-int32_t(m_master_volume))/int32_t(num_fade_samples);
+  m_master_fade_step=step?step:m_master_fade_target<m_master_volume?-1:1;
+}
+//----
+
+void pmf_player::set_tempo_scale(uint16_t scale_)
+{
+  // scale the song tempo (8.8 fp, 256=original tempo), applied from the next tick on
+  m_tempo_scale=scale_?scale_:1;
+  if(m_speed)
+    update_batch_samples();
+}
+//----
+
+void pmf_player::set_pitch_scale(uint16_t scale_)
+{
+  // scale the pitch of all notes (8.8 fp, 256=original pitch) and update the playing notes
+  m_pitch_scale=scale_?scale_:1;
+  if(!m_speed)
+    return;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    audio_channel &chl=m_channels[ci];
+    if(chl.sample_speed)
+      chl.sample_speed=get_sample_speed(chl.smp_metadata, chl.note_period, chl.sample_speed>=0);
+  }
+}
+//----
+
+#if PMF_USE_ECHO==1
+void pmf_player::set_echo(int16_t *delay_buffer_, uint8_t feedback_, uint8_t level_)
+{
+  // the delay buffer must have pmfplayer_echo_delay samples per output channel (0=disable echo, new buffer is cleared by the mixer)
+  if(delay_buffer_!=m_echo_buffer)
+    m_echo_pos=unsigned(-1);
+  m_echo_buffer=delay_buffer_;
+  m_echo_feedback=feedback_;
+  m_echo_level=level_;
+}
+//----
+
+void pmf_player::set_channel_echo_send(uint8_t channel_idx_, uint8_t send_level_)
+{
+  // set level of the channel sent to the echo delay line (0.8 fp)
+  if(channel_idx_<pmfplayer_max_channels)
+    m_echo_sends[channel_idx_]=send_level_;
+}
+#endif
 //---------------------------------------------------------------------------
 
 uint8_t pmf_player::num_pattern_channels() const
@@ -318,44 +550,174 @@ uint16_t pmf_player::playlist_length() const
 }
 //---------------------------------------------------------------------------
 
-void pmf_player::start(uint32_t sampling_freq_, uint16_t playlist_pos_)
+uint32_t pmf_player::calibrate_sampling_freq(const uint32_t *sampling_freqs_, uint8_t num_sampling_freqs_, uint8_t cpu_margin_)
 {
-  // initialize channels
-  if(!m_pmf_file)
-    return;
-  memset(m_channels, 0, sizeof(m_channels));
-  uint16_t playlist_len=pgm_read_word(m_pmf_file+pmfcfg_offset_playlist_length);
-  for(unsigned ci=0; ci<m_num_playback_channels; ++ci)
+  // find the highest and lowest supported candidate frequencies
+  if(!num_sampling_freqs_)
+    return 0;
+  uint32_t max_freq=0, min_freq=uint32_t(-1);
+  for(uint8_t fi=0; fi<num_sampling_freqs_; ++fi)
   {
-    audio_channel &chl=m_channels[ci];
-    chl.sample_panning=pgm_read_byte(m_pmf_file+pmfcfg_offset_playlist+playlist_len+ci);
-    chl.fxmem_vol_slide_spd=pmffx_volsldtype_down|0x01;
-    chl.vol_env.value=0xffff;
-    chl.pitch_env.value=0x8000;
+    uint32_t freq=get_sampling_freq(sampling_freqs_[fi]);
+    max_freq=max(max_freq, freq);
+    min_freq=min(min_freq, freq);
   }
+  if(!m_pmf_file || !m_num_samples || m_speed)
+    return min_freq;
+
+  // sequence the song from the start at the highest frequency without callbacks, the staged song and with all channels audible
+  enum {max_calibration_ticks=1024};
+  enum {num_calibration_batches=16, num_calibration_batch_samples=16};
+  pmf_row_callback_t row_callback=m_row_callback;
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  pmf_batch_row_callback_t batch_row_callback=m_batch_row_callback;
+  m_batch_row_callback=0;
+#endif
+  pmf_tick_callback_t tick_callback=m_tick_callback;
+  pmf_song_end_callback_t song_end_callback=m_song_end_callback;
+  const uint8_t *next_pmf_file=m_next_pmf_file;
+  pmf_channel_mask_t channel_mute_mask=m_channel_mute_mask, channel_solo_mask=m_channel_solo_mask;
+  uint16_t master_gain=m_master_gain;
+  m_row_callback=0;
+  m_tick_callback=0;
+  m_song_end_callback=0;
+  m_next_pmf_file=0;
+  m_channel_mute_mask=0;
+  m_channel_solo_mask=0;
+  m_master_gain=256;
+  m_sampling_freq=max_freq/PMF_MIXING_RATE_DIVIDER;
+  init_song(0);
+  m_mix_pmf_file=m_pmf_file;
+  memset(m_voices, 0, sizeof(m_voices));
+  m_voice_reset_mask=pmf_channel_mask_t(-1);
+  m_tick_queue_write_count=0;
+  m_tick_queue_read_count=0;
+
+  // collect the last audible voice of each channel until all channels have played or the song ends
+  mixer_voice voices[pmfplayer_max_channels];
+  memset(voices, 0, sizeof(voices));
+  pmf_channel_mask_t audible_mask=0;
+  uint8_t num_audible_voices=0;
+  for(uint16_t ti=0; ti<max_calibration_ticks && !m_is_song_stopped && num_audible_voices<m_num_processed_pattern_channels; ++ti)
+  {
+    sequence_tick();
+    if(!apply_queued_tick())
+      break;
+    for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+      if(m_voices[ci].sample_speed && m_voices[ci].volume)
+      {
+        voices[ci]=m_voices[ci];
+        if(!((audible_mask>>ci)&1))
+          ++num_audible_voices;
+        audible_mask|=pmf_channel_mask_t(1)<<ci;
+      }
+  }
+
+  // play the collected voices on all playback channels (incl. sound effect channels) for the worst case load
+  num_audible_voices=0;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+    if((audible_mask>>ci)&1)
+      voices[num_audible_voices++]=voices[ci];
+  for(uint8_t ci=num_audible_voices; num_audible_voices && ci<m_num_playback_channels; ++ci)
+    voices[ci]=voices[ci%num_audible_voices];
+
+  // time mixing of the voices into scratch buffers without playback processing (voices are restarted for each batch)
+  int32_t scratch[num_calibration_batch_samples*2]; // fits the mixer buffer of any platform
+#if PMF_USE_ECHO==1
+  int32_t scratch_send[num_calibration_batch_samples*2];
+#endif
+  uint32_t mix_time=0;
+  for(uint8_t bi=0; bi<num_calibration_batches; ++bi)
+  {
+    memcpy(m_voices, voices, sizeof(m_voices));
+    memset(scratch, 0, sizeof(scratch));
+    pmf_mixer_buffer buf;
+    buf.begin=scratch;
+    buf.num_samples=num_calibration_batch_samples;
+#if PMF_USE_ECHO==1
+    memset(scratch_send, 0, sizeof(scratch_send));
+    buf.echo_send=scratch_send;
+#endif
+    uint32_t start_time=micros();
+    mix_samples(buf, num_calibration_batch_samples);
+    mix_time+=micros()-start_time;
+  }
+  float mix_time_per_sample=float(mix_time)/float(num_calibration_batches*num_calibration_batch_samples*PMF_MIXING_RATE_DIVIDER);
+
+  // restore the stopped player state
+  m_speed=0;
+  memset(m_voices, 0, sizeof(m_voices));
+  m_tick_queue_write_count=0;
+  m_tick_queue_read_count=0;
+  m_row_callback=row_callback;
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  m_batch_row_callback=batch_row_callback;
+#endif
+  m_tick_callback=tick_callback;
+  m_song_end_callback=song_end_callback;
+  m_next_pmf_file=next_pmf_file;
+  m_channel_mute_mask=channel_mute_mask;
+  m_channel_solo_mask=channel_solo_mask;
+  m_master_gain=master_gain;
+
+  // pick the highest candidate frequency that leaves the requested CPU margin
+  float max_mix_time=(100-min(cpu_margin_, uint8_t(100)))*(1000000.0f/100.0f);
+  uint32_t best_freq=min_freq;
+  for(uint8_t fi=0; fi<num_sampling_freqs_; ++fi)
+  {
+    uint32_t freq=get_sampling_freq(sampling_freqs_[fi]);
+    if(freq>best_freq && mix_time_per_sample*freq<=max_mix_time)
+      best_freq=freq;
+  }
+  PMF_SERIAL_LOG("PMF sampling frequency calibrated to %liHz (%i us / 1000 samples)\r\n", (long)best_freq, int(mix_time_per_sample*1000.0f));
+  return best_freq;
+}
+//----
 
+void pmf_player::start(uint32_t sampling_freq_, uint16_t playlist_pos_)
+{
   // init playback state
-  m_sampling_freq=get_sampling_freq(sampling_freq_);
-  m_num_processed_pattern_channels=min(m_num_pattern_channels, m_num_playback_channels);
-  init_pattern(playlist_pos_<playlist_len?playlist_pos_:0);
-  m_speed=pgm_read_byte(m_pmf_file+pmfcfg_offset_init_speed);
-  m_note_period_min=pgm_read_word(m_pmf_file+pmfcfg_offset_note_period_min);
-  m_note_period_max=pgm_read_word(m_pmf_file+pmfcfg_offset_note_period_max);
-  m_num_batch_samples=(m_sampling_freq*125)/long(pgm_read_byte(m_pmf_file+pmfcfg_offset_init_tempo)*50);
-  m_current_row_tick=m_speed-1;
-  m_arpeggio_counter=0;
-  m_pattern_delay=1;
+  if(!m_pmf_file)
+    return;
+  m_sampling_freq=m_layer_owner?m_layer_owner->m_sampling_freq:get_sampling_freq(sampling_freq_)/PMF_MIXING_RATE_DIVIDER;
+  init_song(playlist_pos_);
+
+  // reset the tick queue and voices (all voices are reset by the first tick)
+  m_mix_pmf_file=m_pmf_file;
+  m_is_mix_stopped=false;
+  memset(m_voices, 0, sizeof(m_voices));
+  m_voice_reset_mask=pmf_channel_mask_t(-1);
+  m_tick_queue_write_count=0;
+  m_tick_queue_read_count=0;
+  m_tick_samples_left=0;
+  m_sfx_queue_write_count=0;
+  m_sfx_queue_read_count=0;
+  memset(m_sfx_priorities, 0, sizeof(m_sfx_priorities));
+  m_command_queue_write_count=0;
+  m_command_queue_read_count=0;
+#if PMF_USE_STATE_SNAPSHOTS==1
+  memset(m_states, 0, sizeof(m_states));
+  m_state_seq=0;
+#endif
 
   // start playback
-  m_batch_pos=0;
-  start_playback(sampling_freq_);
+#if PMF_USE_QUALITY_GOVERNOR==1
+  m_quality_level=0;
+  m_quality_drop_mask=0;
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+  memset(m_channel_level_peaks, 0, sizeof(m_channel_level_peaks));
+  memset(m_channel_level_rms, 0, sizeof(m_channel_level_rms));
+#endif
+  if(!m_layer_owner)
+    start_playback(sampling_freq_);
   PMF_SERIAL_LOG("PMF playback started (%i channels)\r\n", m_num_playback_channels);
 }
 //----
 
 void pmf_player::stop()
 {
-  if(m_speed)
+  if(m_speed && !m_layer_owner)
     stop_playback();
   m_speed=0;
 }
@@ -363,43 +725,159 @@ void pmf_player::stop()
 
 void pmf_player::update()
 {
-  // check if audio buffer should be updated
-  if(!m_note_slide_speed)
+  // check if audio buffer should be updated (layers are updated by the owner)
+  if(!m_note_slide_speed || m_layer_owner)
     return;
   pmf_mixer_buffer subbuffer=get_mixer_buffer();
   if(!subbuffer.num_samples)
     return;
+#if PMF_USE_QUALITY_GOVERNOR==1
+  uint32_t update_start_time=micros();
+#endif
+#if PMF_USE_QUALITY_GOVERNOR==1 || PMF_USE_CHANNEL_METERS==1
+  unsigned num_subbuffer_samples=subbuffer.num_samples;
+#endif
+  for(pmf_player *player=this; player; player=player->m_next_layer)
+    if(player->m_num_sfx_channels)
+      player->apply_queued_sfx();
 
   // update audio buffer
   do
   {
-    // mix batch of samples
-    uint16_t batch_left=m_num_batch_samples-m_batch_pos;
-    unsigned num_samples=min(subbuffer.num_samples, batch_left);
-    mix_buffer(subbuffer, num_samples);
-    m_batch_pos+=num_samples;
-
-    // check for new batch
-    if(m_batch_pos==m_num_batch_samples)
+    // get voice parameters for the next ticks of the player and playing layers (sequence ticks unless sequencing on a separate thread)
+    unsigned num_samples=subbuffer.num_samples;
+    for(pmf_player *player=this; player; player=player->m_next_layer)
     {
-      if(++m_current_row_tick==m_speed)
+      if(player!=this && !player->m_speed)
+        continue;
+      if(!player->m_tick_samples_left)
       {
-        if(!--m_pattern_delay)
-        {
-          m_pattern_delay=1;
-          process_pattern_row();
-        }
-        m_current_row_tick=0;
+        if(!m_sequencer_thread)
+          update_sequencer();
+        if(!player->apply_queued_tick())
+          player->m_tick_samples_left=subbuffer.num_samples; // sequencer is behind, keep mixing current voices
       }
-      else
-        apply_channel_effects();
-      if(m_num_instruments)
-        evaluate_envelopes();
-      if(m_tick_callback)
-        (*m_tick_callback)(m_tick_callback_custom_data);
-      m_batch_pos=0;
+      num_samples=min(num_samples, unsigned(player->m_tick_samples_left));
+    }
+
+    // mix batch of samples up to the next tick of any player
+    mix_buffer(subbuffer, num_samples);
+    for(pmf_player *player=this; player; player=player->m_next_layer)
+    {
+      if(player!=this && !player->m_speed)
+        continue;
+      player->m_tick_samples_left-=num_samples;
+      if(player->m_master_fade_step)
+        player->update_master_fade(num_samples);
     }
   } while(subbuffer.num_samples);
+#if PMF_USE_CHANNEL_METERS==1
+  for(pmf_player *player=this; player; player=player->m_next_layer)
+    if(player==this || player->m_speed)
+      player->update_channel_levels(num_subbuffer_samples);
+#endif
+#if PMF_USE_QUALITY_GOVERNOR==1
+  update_quality_governor(micros()-update_start_time, num_subbuffer_samples);
+#endif
+
+  // stop playback once the last tick of a stopped song has been mixed
+  for(pmf_player *player=this; player; player=player->m_next_layer)
+    if(player->m_is_mix_stopped)
+      player->stop();
+}
+//----
+
+void pmf_player::enable_sequencer_thread(bool enable_)
+{
+  // when enabled, update_sequencer() must be called on a separate thread to sequence ticks ahead of update()
+  m_sequencer_thread=enable_;
+}
+//----
+
+void pmf_player::update_sequencer()
+{
+  // sequence ticks of the player and playing layers until the tick queues are full
+  for(pmf_player *player=this; player; player=player->m_next_layer)
+    if(player->m_speed)
+      while(uint8_t(player->m_tick_queue_write_count-PMF_ATOMIC_LOAD(player->m_tick_queue_read_count))<pmfplayer_tick_queue_size)
+        player->sequence_tick();
+}
+//----
+
+bool pmf_player::set_next_song(const void *pmem_pmf_file_, uint16_t playlist_pos_)
+{
+  // stage PMF file to be started at the tick the current song ends (0=cancel)
+  const uint8_t *pmf_file=static_cast<const uint8_t*>(pmem_pmf_file_);
+  if(pmf_file && !is_valid_pmf_file(pmf_file))
+    return false;
+  m_next_pmf_file=pmf_file;
+  m_next_playlist_pos=playlist_pos_;
+  return true;
+}
+//----
+
+bool pmf_player::play_sfx(uint8_t sample_idx_, uint8_t note_idx_, uint8_t volume_, int8_t panning_, uint8_t priority_)
+{
+  // queue sound effect to start at the beginning of the next mixed sub-buffer (false if the queue is full)
+  // note: samples pitch baked by the converter (-bake) play at the baked pitch regardless of note_idx_
+  if(!m_speed || !m_num_sfx_channels || sample_idx_>=m_num_samples || note_idx_>=pmfcfg_note_cut)
+    return false;
+  uint8_t write_count=m_sfx_queue_write_count;
+  if(uint8_t(write_count-PMF_ATOMIC_LOAD(m_sfx_queue_read_count))>=pmfplayer_sfx_queue_size)
+    return false;
+  sfx_request &sfx=m_sfx_queue[write_count%pmfplayer_sfx_queue_size];
+  sfx.smp_metadata=m_pmf_file+pgm_read_dword(m_pmf_file+pmfcfg_offset_smp_meta_offs)+sample_idx_*pmfcfg_sample_metadata_size;
+  int16_t finetune=pgm_read_byte(sfx.smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_baked_pitch?0:pgm_read_word(sfx.smp_metadata+pmfcfg_offset_smp_finetune);
+  sfx.sample_speed=get_sample_speed(sfx.smp_metadata, get_note_period(note_idx_, finetune), true);
+  sfx.volume=(uint16_t(volume_)*uint16_t(pgm_read_byte(sfx.smp_metadata+pmfcfg_offset_smp_volume)))>>8;
+  sfx.panning=panning_;
+  sfx.priority=priority_;
+  PMF_ATOMIC_STORE(m_sfx_queue_write_count, uint8_t(write_count+1));
+  return true;
+}
+//----
+
+bool pmf_player::post_command(e_pmf_command command_, pmf_channel_mask_t param0_, uint16_t param1_)
+{
+  // queue command to be applied at the beginning of the next sequenced tick (single producer, false if the queue is full)
+  uint8_t write_count=m_command_queue_write_count;
+  if(uint8_t(write_count-PMF_ATOMIC_LOAD(m_command_queue_read_count))>=pmfplayer_command_queue_size)
+    return false;
+  player_command &cmd=m_command_queue[write_count%pmfplayer_command_queue_size];
+  cmd.param0=param0_;
+  cmd.param1=param1_;
+  cmd.type=uint8_t(command_);
+  PMF_ATOMIC_STORE(m_command_queue_write_count, uint8_t(write_count+1));
+  return true;
+}
+//----
+
+void pmf_player::attach_layer(pmf_player &layer_)
+{
+  // attach player to be sequenced and mixed to the audio output of this player (start the layer after starting this player)
+  if(layer_.m_layer_owner || m_layer_owner || &layer_==this)
+    return;
+  layer_.stop();
+  layer_.m_layer_owner=this;
+  pmf_player *last=this;
+  while(last->m_next_layer)
+    last=last->m_next_layer;
+  last->m_next_layer=&layer_;
+}
+//----
+
+void pmf_player::detach_layer(pmf_player &layer_)
+{
+  // stop the layer and remove it from the layers of this player
+  if(layer_.m_layer_owner!=this)
+    return;
+  layer_.stop();
+  pmf_player *prev=this;
+  while(prev->m_next_layer!=&layer_)
+    prev=prev->m_next_layer;
+  prev->m_next_layer=layer_.m_next_layer;
+  layer_.m_layer_owner=0;
+  layer_.m_next_layer=0;
 }
 //---------------------------------------------------------------------------
 
@@ -427,6 +905,16 @@ uint8_t pmf_player::pattern_speed() const
 }
 //----
 
+uint8_t pmf_player::quality_level() const
+{
+#if PMF_USE_QUALITY_GOVERNOR==1
+  return m_quality_level;
+#else
+  return 0;
+#endif
+}
+//----
+
 pmf_channel_info pmf_player::channel_info(uint8_t channel_idx_) const
 {
   pmf_channel_info info;
@@ -439,6 +927,10 @@ pmf_channel_info pmf_player::channel_info(uint8_t channel_idx_) const
     info.effect=chl.effect;
     info.effect_data=chl.effect_data;
     info.note_hit=chl.note_hit;
+#if PMF_USE_CHANNEL_METERS==1
+    info.level_peak=m_channel_level_peaks[channel_idx_];
+    info.level_rms=m_channel_level_rms[channel_idx_];
+#endif
   }
   else
   {
@@ -448,11 +940,489 @@ pmf_channel_info pmf_player::channel_info(uint8_t channel_idx_) const
     info.effect=0xff;
     info.effect_data=0;
     info.note_hit=0;
+#if PMF_USE_CHANNEL_METERS==1
+    info.level_peak=0;
+    info.level_rms=0;
+#endif
   }
   return info;
 }
+//----
+
+#if PMF_USE_STATE_SNAPSHOTS==1
+void pmf_player::read_state(pmf_player_state &state_) const
+{
+  // copy the last published state (retry if a new state was published during the copy)
+  uint8_t seq;
+  do
+  {
+    seq=PMF_ATOMIC_LOAD(m_state_seq);
+    memcpy(&state_, &m_states[seq&1], sizeof(state_));
+    PMF_ACQUIRE_FENCE();
+  } while(PMF_ATOMIC_LOAD(m_state_seq)!=seq);
+}
+//----
+#endif
+
+pmf_channel_mask_t pmf_player::channel_mute_mask() const
+{
+  return m_channel_mute_mask;
+}
+//----
+
+pmf_channel_mask_t pmf_player::channel_solo_mask() const
+{
+  return m_channel_solo_mask;
+}
+//----
+
+uint8_t pmf_player::master_volume() const
+{
+  return uint8_t(min(m_master_volume>>16, uint32_t(255)));
+}
+//----
+
+uint16_t pmf_player::tempo_scale() const
+{
+  return m_tempo_scale;
+}
+//----
+
+uint16_t pmf_player::pitch_scale() const
+{
+  return m_pitch_scale;
+}
 //---------------------------------------------------------------------------
 
+pmf_channel_mask_t pmf_player::channel_mix_mask() const
+{
+  // mask of channels mixed to the output (bit per channel)
+  pmf_channel_mask_t mask=(m_channel_solo_mask?m_channel_solo_mask:pmf_channel_mask_t(-1))&~m_channel_mute_mask;
+#if PMF_USE_QUALITY_GOVERNOR==1
+  mask&=~m_quality_drop_mask;
+#endif
+  return mask;
+}
+//----
+
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+void pmf_player::init_interpolation_kernel()
+{
+  // build 2.14fp kernel taps for each 8-bit sample position fraction (taps span samples [1-n/2, n/2] around the position)
+  static bool s_is_initialized=false;
+  if(s_is_initialized)
+    return;
+  s_is_initialized=true;
+  enum {num_taps=PMF_USE_KERNEL_INTERPOLATION};
+  for(unsigned fi=0; fi<256; ++fi)
+  {
+    float frc=float(fi)*(1.0f/256.0f), weights[num_taps], weight_sum=0.0f;
+    for(unsigned ti=0; ti<num_taps; ++ti)
+    {
+      float x=fabsf(float(int(ti)-int(num_taps/2-1))-frc), w;
+      if(num_taps==4)
+      {
+        // Catmull-Rom cubic
+        w=x<1.0f?(1.5f*x-2.5f)*x*x+1.0f:((-0.5f*x+2.5f)*x-4.0f)*x+2.0f;
+      }
+      else
+      {
+        // Lanczos windowed sinc
+        const float pi=3.14159265f, a=float(num_taps/2);
+        w=x<1.0e-6f?1.0f:a*sinf(pi*x)*sinf(pi*x/a)/(pi*pi*x*x);
+      }
+      weights[ti]=w;
+      weight_sum+=w;
+    }
+
+    // quantize normalized weights so that the taps sum exactly to 1.0
+    int16_t *taps=s_interpolation_kernel[fi];
+    int16_t tap_sum=0;
+    for(unsigned ti=0; ti<num_taps; ++ti)
+    {
+      taps[ti]=int16_t(floorf(weights[ti]*16384.0f/weight_sum+0.5f));
+      tap_sum+=taps[ti];
+    }
+    taps[fi<128?num_taps/2-1:num_taps/2]+=16384-tap_sum;
+#if defined(__ARM_FEATURE_DSP) && !defined(__SSE2__)
+    // reorder taps to [0, 2, 1, 3] per 4 samples for the dual MAC kernel
+    for(unsigned ti=0; ti<num_taps; ti+=4)
+    {
+      int16_t tap=taps[ti+1];
+      taps[ti+1]=taps[ti+2];
+      taps[ti+2]=tap;
+    }
+#endif
+  }
+}
+//----
+#endif
+
+#if PMF_USE_CHANNEL_METERS==1
+void pmf_player::update_channel_levels(unsigned num_samples_)
+{
+  // publish channel levels accumulated by the mixer for the sub-buffer and reset the meters
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    mixer_voice &voice=m_voices[ci];
+    m_channel_level_peaks[ci]=uint8_t(min(voice.meter_peak, uint16_t(255)));
+    m_channel_level_rms[ci]=isqrt(uint16_t(min(voice.meter_sum_sq/num_samples_, uint32_t(0xffff))));
+    voice.meter_peak=0;
+    voice.meter_sum_sq=0;
+  }
+}
+//----
+#endif
+
+void pmf_player::update_master_fade(unsigned num_samples_)
+{
+  // advance master volume fade by the number of mixed samples
+  uint32_t volume=m_master_volume, target=m_master_fade_target;
+  uint32_t step=uint32_t(m_master_fade_step<0?-m_master_fade_step:m_master_fade_step);
+  uint32_t dist=target>volume?target-volume:volume-target;
+  if(num_samples_>=dist/step)
+  {
+    volume=target;
+    m_master_fade_step=0;
+  }
+  else
+    volume=target>volume?volume+step*num_samples_:volume-step*num_samples_;
+  m_master_volume=volume;
+  m_master_gain=uint16_t(volume>>16);
+}
+//----
+
+#if PMF_USE_QUALITY_GOVERNOR==1
+void pmf_player::update_quality_governor(uint32_t update_time_us_, unsigned num_samples_)
+{
+  // step quality level down/up based on the time spent vs playback time of the sub-buffer
+  uint32_t subbuffer_time_us=(uint32_t(num_samples_)*1000000)/m_sampling_freq;
+  uint8_t num_interpolation_levels=PMF_USE_LINEAR_INTERPOLATION==1?1:0;
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+  if(m_pmf_flags&pmfflag_padded_samples)
+    ++num_interpolation_levels;
+#endif
+  uint8_t max_level=num_interpolation_levels+m_num_playback_channels-1;
+  if(update_time_us_*100>subbuffer_time_us*pmfplayer_governor_max_load)
+  {
+    if(m_quality_level<max_level)
+      ++m_quality_level;
+  }
+  else if(update_time_us_*100<subbuffer_time_us*pmfplayer_governor_min_load && m_quality_level)
+    --m_quality_level;
+
+  // drop the quietest active channels for levels beyond disabled interpolation
+  m_quality_drop_mask=0;
+  for(uint8_t di=num_interpolation_levels; di<m_quality_level; ++di)
+  {
+    uint8_t drop_idx=0xff;
+    uint16_t drop_volume=0xffff;
+    for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+    {
+      const mixer_voice &voice=m_voices[ci];
+      uint16_t volume=voice.volume;
+      if(voice.sample_speed && volume<drop_volume && !(m_quality_drop_mask&(pmf_channel_mask_t(1)<<ci)))
+      {
+        drop_idx=ci;
+        drop_volume=volume;
+      }
+    }
+    if(drop_idx==0xff)
+      break;
+    m_quality_drop_mask|=pmf_channel_mask_t(1)<<drop_idx;
+  }
+}
+//----
+#endif
+
+void pmf_player::advance_sample_pos(const uint8_t *smp_metadata_, sample_pos_t &sample_pos_, sample_speed_t &sample_speed_, unsigned num_samples_)
+{
+  // advance sample position by the number of samples without mixing
+  sample_speed_t sample_speed=sample_speed_;
+  sample_pos_t sample_pos=sample_pos_+(sample_step_t(sample_speed)*sample_step_t(num_samples_)<<sample_step_shift);
+  sample_pos_t sample_end=sample_pos_t(pgm_read_dword(smp_metadata_+pmfcfg_offset_smp_length))<<sample_pos_frc_bits;
+  sample_pos_t sample_loop_len=sample_pos_t(pgm_read_dword(smp_metadata_+pmfcfg_offset_smp_loop_length_and_panning)&0xffffff)<<sample_pos_frc_bits;
+  sample_pos_t sample_loop_start=sample_end-sample_loop_len;
+  if(sample_speed>0)
+  {
+    // check for passing the sample end and stop one-shot samples
+    if(sample_pos<sample_end)
+    {
+      sample_pos_=sample_pos;
+      return;
+    }
+    if(!sample_loop_len)
+    {
+      sample_speed_=0;
+      return;
+    }
+    sample_pos-=sample_loop_start;
+  }
+  else
+  {
+    // check for passing the loop start (bidi loop playing backwards)
+    sample_step_t loop_pos=sample_step_t(sample_pos-sample_loop_start);
+    if(loop_pos>=0)
+    {
+      sample_pos_=sample_pos;
+      return;
+    }
+    sample_pos=-loop_pos;
+  }
+
+  // wrap the position to the loop (bidi loops wrap to twice the loop length and mirror the second half)
+  bool is_bidi=mixer_bidi_loops && (pgm_read_byte(smp_metadata_+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop);
+  if(is_bidi)
+  {
+    sample_pos%=sample_loop_len*2;
+    sample_speed=sample_speed<0?-sample_speed:sample_speed;
+    if(sample_pos>=sample_loop_len)
+    {
+      sample_pos=sample_loop_len*2-sample_pos;
+      sample_speed=-sample_speed;
+    }
+    sample_speed_=sample_speed;
+  }
+  else
+    sample_pos%=sample_loop_len;
+  sample_pos_=sample_loop_start+sample_pos;
+}
+//----
+
+void pmf_player::sequence_tick()
+{
+  // apply queued commands at the tick boundary
+  tick_snapshot &tick=m_tick_queue[m_tick_queue_write_count%pmfplayer_tick_queue_size];
+  apply_queued_commands(tick);
+
+  // publish voice parameters for the next tick to the queue
+  tick.num_samples=m_num_batch_samples;
+  tick.voice_reset_mask=m_voice_reset_mask;
+  tick.pmf_file=m_pmf_file;
+  tick.is_song_stopped=m_is_song_stopped;
+  tick.num_channels=m_num_playback_channels;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    const audio_channel &chl=m_channels[ci];
+    voice_params &voice=tick.voices[ci];
+    voice.smp_metadata=chl.smp_metadata;
+    voice.sample_pos=chl.sample_pos;
+    voice.sample_speed=chl.sample_speed;
+    voice.volume=(chl.sample_volume*(chl.vol_env.value>>8))>>8;
+    voice.panning=chl.sample_panning;
+#if PMF_USE_RESONANT_FILTERS==1
+    get_filter_coeffs(voice.filter_coeffs, chl.filter_cutoff, chl.filter_resonance);
+#endif
+  }
+  PMF_ATOMIC_STORE(m_tick_queue_write_count, uint8_t(m_tick_queue_write_count+1));
+
+  // predict sample positions at the end of the tick (the sequencer never reads the mixer state)
+  const uint8_t *smp_metadata[pmfplayer_max_channels];
+  sample_pos_t sample_pos[pmfplayer_max_channels];
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    audio_channel &chl=m_channels[ci];
+    if(chl.sample_speed)
+      advance_sample_pos(chl.smp_metadata, chl.sample_pos, chl.sample_speed, tick.num_samples);
+    smp_metadata[ci]=chl.smp_metadata;
+    sample_pos[ci]=chl.sample_speed?chl.sample_pos:sample_pos_t(-1);
+  }
+
+  // process the tick
+  if(m_is_song_stopped)
+    return;
+  if(++m_current_row_tick==m_speed)
+  {
+    if(!--m_pattern_delay)
+    {
+      m_pattern_delay=1;
+      process_pattern_row();
+    }
+    m_current_row_tick=0;
+  }
+  else
+    apply_channel_effects();
+  if(m_num_instruments)
+    evaluate_envelopes();
+  if(m_tick_callback)
+    (*m_tick_callback)(m_tick_callback_custom_data);
+#if PMF_USE_STATE_SNAPSHOTS==1
+  publish_state();
+#endif
+
+  // reset voices whose sample or position was changed by the tick (or added by the next song)
+  m_voice_reset_mask=0;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    const audio_channel &chl=m_channels[ci];
+    if(chl.sample_speed && (ci>=tick.num_channels || chl.smp_metadata!=smp_metadata[ci] || chl.sample_pos!=sample_pos[ci]))
+      m_voice_reset_mask|=pmf_channel_mask_t(1)<<ci;
+  }
+}
+//----
+
+bool pmf_player::apply_queued_tick()
+{
+  // check for sequenced tick in the queue
+  uint8_t read_count=m_tick_queue_read_count;
+  if(PMF_ATOMIC_LOAD(m_tick_queue_write_count)==read_count)
+    return false;
+
+  // stop sound effects sampled from the previous song (the tick has the channels it was sequenced with)
+  const tick_snapshot &tick=m_tick_queue[read_count%pmfplayer_tick_queue_size];
+  uint8_t num_sequenced_channels=tick.num_channels-m_num_sfx_channels;
+  if(tick.pmf_file!=m_mix_pmf_file)
+    for(uint8_t ci=num_sequenced_channels; ci<tick.num_channels; ++ci)
+      m_voices[ci].sample_speed=0;
+
+  // apply voice parameters (the mixer owns position and direction of voices that aren't reset, and sound effect voices)
+  pmf_channel_mask_t reset_mask=tick.voice_reset_mask;
+  for(uint8_t ci=0; ci<num_sequenced_channels; ++ci)
+  {
+    const voice_params &params=tick.voices[ci];
+    mixer_voice &voice=m_voices[ci];
+#if PMF_USE_RESONANT_FILTERS==1
+    // reset filter history for (re)started and newly filtered voices
+    if(reset_mask&1 || !voice.filter_coeffs[0])
+      voice.filter_hist[0]=voice.filter_hist[1]=0;
+    memcpy(voice.filter_coeffs, params.filter_coeffs, sizeof(voice.filter_coeffs));
+#endif
+    if(reset_mask&1)
+    {
+      voice.smp_metadata=params.smp_metadata;
+      voice.sample_pos=params.sample_pos;
+      voice.sample_speed=params.sample_speed;
+    }
+    else if(!params.sample_speed)
+      voice.sample_speed=0;
+    else if(voice.sample_speed)
+    {
+      sample_speed_t speed=params.sample_speed<0?-params.sample_speed:params.sample_speed;
+      voice.sample_speed=voice.sample_speed<0?-speed:speed;
+    }
+    voice.volume=params.volume;
+    voice.panning=params.panning;
+    reset_mask>>=1;
+  }
+  for(uint8_t i=0; i<tick.num_commands; ++i)
+    apply_mixer_command(tick.commands[i]);
+  m_mix_pmf_file=tick.pmf_file;
+  if(tick.is_song_stopped)
+    m_is_mix_stopped=true;
+  m_tick_samples_left=tick.num_samples;
+  PMF_ATOMIC_STORE(m_tick_queue_read_count, uint8_t(read_count+1));
+  return true;
+}
+//----
+
+void pmf_player::apply_queued_commands(tick_snapshot &tick_)
+{
+  // apply sequencer commands and pass mixer commands to the mixer with the tick
+  tick_.num_commands=0;
+  uint8_t read_count=m_command_queue_read_count;
+  for(; read_count!=PMF_ATOMIC_LOAD(m_command_queue_write_count); ++read_count)
+  {
+    const player_command &cmd=m_command_queue[read_count%pmfplayer_command_queue_size];
+    switch(cmd.type)
+    {
+      case pmfcmd_set_tempo_scale: set_tempo_scale(uint16_t(cmd.param0)); break;
+      case pmfcmd_set_pitch_scale: set_pitch_scale(uint16_t(cmd.param0)); break;
+
+      case pmfcmd_seek:
+      {
+        // process the given pattern row at this tick
+        if(cmd.param0<pgm_read_word(m_pmf_file+pmfcfg_offset_playlist_length))
+        {
+          init_pattern(uint8_t(cmd.param0), uint8_t(cmd.param1));
+          m_current_row_tick=m_speed-1;
+          m_pattern_delay=1;
+          m_is_song_end_pending=false;
+        }
+      } break;
+
+      case pmfcmd_stop: stop_song(); break;
+      default: tick_.commands[tick_.num_commands++]=cmd;
+    }
+  }
+  PMF_ATOMIC_STORE(m_command_queue_read_count, read_count);
+}
+//----
+
+void pmf_player::apply_mixer_command(const player_command &cmd_)
+{
+  switch(cmd_.type)
+  {
+    case pmfcmd_set_master_volume: set_master_volume(uint8_t(cmd_.param0)); break;
+    case pmfcmd_fade_to: fade_to(uint8_t(cmd_.param0), cmd_.param1); break;
+    case pmfcmd_set_channel_mute_mask: set_channel_mute_mask(pmf_channel_mask_t(cmd_.param0)); break;
+    case pmfcmd_set_channel_solo_mask: set_channel_solo_mask(pmf_channel_mask_t(cmd_.param0)); break;
+  }
+}
+//----
+
+#if PMF_USE_STATE_SNAPSHOTS==1
+void pmf_player::publish_state()
+{
+  // write the state to the back buffer and flip it to the front with the sequence count
+  uint8_t seq=m_state_seq;
+  PMF_RELEASE_FENCE(); // keep the back buffer writes after the previous sequence count store
+  pmf_player_state &state=m_states[(seq+1)&1];
+  state.tick_count=m_states[seq&1].tick_count+1;
+  state.playlist_pos=playlist_pos();
+  state.pattern_row=pattern_row();
+  state.pattern_tick=m_current_row_tick;
+  state.pattern_speed=m_speed;
+  state.num_channels=m_num_playback_channels;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+    state.channels[ci]=channel_info(ci);
+  PMF_ATOMIC_STORE(m_state_seq, uint8_t(seq+1));
+}
+//----
+#endif
+
+void pmf_player::apply_queued_sfx()
+{
+  // start queued sound effects on free channels or steal the lowest priority (oldest for equal priority) sound effect
+  uint8_t read_count=m_sfx_queue_read_count;
+  uint8_t first_channel=m_num_playback_channels-m_num_sfx_channels;
+  for(; read_count!=PMF_ATOMIC_LOAD(m_sfx_queue_write_count); ++read_count)
+  {
+    const sfx_request &sfx=m_sfx_queue[read_count%pmfplayer_sfx_queue_size];
+    uint8_t channel_idx=0xff;
+    for(uint8_t ci=first_channel; ci<m_num_playback_channels; ++ci)
+    {
+      if(!m_voices[ci].sample_speed)
+      {
+        channel_idx=ci;
+        break;
+      }
+      if(   m_sfx_priorities[ci]<=sfx.priority
+         && (   channel_idx==0xff
+             || m_sfx_priorities[ci]<m_sfx_priorities[channel_idx]
+             || (m_sfx_priorities[ci]==m_sfx_priorities[channel_idx] && uint16_t(m_sfx_start_count-m_sfx_start_counts[ci])>uint16_t(m_sfx_start_count-m_sfx_start_counts[channel_idx]))))
+        channel_idx=ci;
+    }
+    if(channel_idx==0xff)
+      continue; // all channels play higher priority sound effects
+
+    // start the sound effect from the beginning of the sample
+    mixer_voice &voice=m_voices[channel_idx];
+    voice.smp_metadata=sfx.smp_metadata;
+    voice.sample_pos=0;
+    voice.sample_speed=sfx.sample_speed;
+    voice.volume=sfx.volume;
+    voice.panning=sfx.panning;
+#if PMF_USE_RESONANT_FILTERS==1
+    memset(voice.filter_coeffs, 0, sizeof(voice.filter_coeffs));
+    voice.filter_hist[0]=voice.filter_hist[1]=0;
+#endif
+    m_sfx_priorities[channel_idx]=sfx.priority;
+    m_sfx_start_counts[channel_idx]=m_sfx_start_count++;
+  }
+  PMF_ATOMIC_STORE(m_sfx_queue_read_count, read_count);
+}
+//----
+
 void pmf_player::apply_channel_effect_volume_slide(audio_channel &chl_)
 {
   // slide volume either up/down defined by effect
@@ -473,7 +1443,7 @@ void pmf_player::apply_channel_effect_note_slide(audio_channel &chl_)
   note_period+=slide_spd;
   note_period=((slide_spd>0)^(note_period<note_target_prd))?note_target_prd:note_period;
   chl_.note_period=note_period;
-  chl_.sample_speed=note_period<m_note_period_min || note_period>m_note_period_max?0:get_sample_speed(chl_.note_period, chl_.sample_speed>=0);
+  chl_.sample_speed=note_period<m_note_period_min || note_period>m_note_period_max?0:get_sample_speed(chl_.smp_metadata, chl_.note_period, chl_.sample_speed>=0);
 }
 //----
 
@@ -484,7 +1454,7 @@ void pmf_player::apply_channel_effect_vibrato(audio_channel &chl_)
   uint8_t wave_idx=chl_.fxmem_vibrato_wave&3;
   int8_t vibrato_pos=chl_.fxmem_vibrato_pos;
   int8_t wave_sample=vibrato_pos<0?-int8_t(pgm_read_byte(&s_waveforms[wave_idx][~vibrato_pos])):pgm_read_byte(&s_waveforms[wave_idx][vibrato_pos]);
-  chl_.sample_speed=get_sample_speed(chl_.note_period+(int16_t(wave_sample*chl_.fxmem_vibrato_depth)>>8), chl_.sample_speed>=0);
+  chl_.sample_speed=get_sample_speed(chl_.smp_metadata, chl_.note_period+(int16_t(wave_sample*chl_.fxmem_vibrato_depth)>>8), chl_.sample_speed>=0);
   if((chl_.fxmem_vibrato_pos+=chl_.fxmem_vibrato_spd)>31)
     chl_.fxmem_vibrato_pos-=64;
 }
@@ -516,7 +1486,7 @@ void pmf_player::apply_channel_effects()
           break;
         uint8_t base_note_idx=chl.base_note_idx&127;
         uint16_t note_period=get_note_period(base_note_idx+((chl.fxmem_arpeggio>>(4*m_arpeggio_counter))&0xf), chl.sample_finetune);
-        chl.sample_speed=get_sample_speed(note_period, chl.sample_speed>=0);
+        chl.sample_speed=get_sample_speed(chl.smp_metadata, note_period, chl.sample_speed>=0);
       } break;
 
       case pmffx_note_slide: apply_channel_effect_note_slide(chl); break;
@@ -707,6 +1677,8 @@ void pmf_player::evaluate_envelopes()
   {
     // evaluate volume and pitch envelopes
     audio_channel &chl=m_channels[ci];
+    if(!chl.inst_metadata)
+      continue;
     bool is_note_off=(chl.base_note_idx&0x80)!=0;
     uint16_t vol_env_offset=pgm_read_word(chl.inst_metadata+pmfcfg_offset_inst_vol_env);
     if(vol_env_offset!=0xffff)
@@ -726,6 +1698,14 @@ void pmf_player::evaluate_envelopes()
 }
 //----------------------------------------------------------------------------
 
+void pmf_player::update_batch_samples()
+{
+  // samples per tick for the tempo (BPM) scaled by the tempo scale, i.e. sampling_freq*125/(tempo*tempo_scale*50)
+  uint32_t num_samples=(m_sampling_freq*640)/(uint32_t(m_tempo)*m_tempo_scale);
+  m_num_batch_samples=uint16_t(num_samples<1?1:num_samples>0xffff?0xffff:num_samples);
+}
+//----
+
 uint16_t pmf_player::get_note_period(uint8_t note_idx_, int16_t finetune_)
 {
   if(m_pmf_flags&pmfflag_linear_freq_table)
@@ -734,17 +1714,58 @@ uint16_t pmf_player::get_note_period(uint8_t note_idx_, int16_t finetune_)
 }
 //----
 
-int16_t pmf_player::get_sample_speed(uint16_t note_period_, bool forward_)
+pmf_player::sample_speed_t pmf_player::get_sample_speed(uint16_t note_period_, bool forward_)
 {
-  int16_t speed;
+  enum {speed_scale=1<<(sample_speed_frc_bits-8)};
+  sample_speed_t speed;
   if(m_pmf_flags&pmfflag_linear_freq_table)
-    speed=int16_t((8363.0f*8.0f/m_sampling_freq)*fast_exp2(float(7680-note_period_)/768.0f)+0.5f);
+    speed=sample_speed_t((8363.0f*8.0f*speed_scale*m_pitch_scale/(256.0f*m_sampling_freq))*fast_exp2(float(7680-note_period_)/768.0f)+0.5f);
   else
-    speed=int16_t((7093789.2f*256.0f/m_sampling_freq)/note_period_+0.5f);
+    speed=sample_speed_t((7093789.2f*256.0f*speed_scale*m_pitch_scale/(256.0f*m_sampling_freq))/note_period_+0.5f);
+  return forward_?speed:-speed;
+}
+//----
+
+pmf_player::sample_speed_t pmf_player::get_sample_speed(const uint8_t *smp_metadata_, uint16_t note_period_, bool forward_)
+{
+  // pitch baked samples play at fixed speed (playback rate in place of the finetune)
+  if(!(pgm_read_byte(smp_metadata_+pmfcfg_offset_smp_flags)&pmfsmpflag_baked_pitch))
+    return get_sample_speed(note_period_, forward_);
+  sample_pos_t rate=sample_pos_t(uint16_t(pgm_read_word(smp_metadata_+pmfcfg_offset_smp_finetune)))*m_pitch_scale; // 24.8 fp (sample_pos_t for the range of wide speeds)
+  sample_speed_t speed=sample_speed_t(((rate<<(sample_speed_frc_bits-8))+m_sampling_freq/2)/m_sampling_freq);
   return forward_?speed:-speed;
 }
 //----
 
+#if PMF_USE_RESONANT_FILTERS==1
+void pmf_player::get_filter_coeffs(int32_t coeffs_[3], uint8_t cutoff_, uint8_t resonance_)
+{
+  // bypass the filter when fully open
+  if(cutoff_==127 && !resonance_)
+  {
+    coeffs_[0]=coeffs_[1]=coeffs_[2]=0;
+    return;
+  }
+
+  // get cutoff frequency from the octave table and calculate IT filter coefficients (8.24 fp)
+  uint32_t freq=(uint32_t(pgm_read_word(s_filter_cutoff_freqs+cutoff_%24))<<(cutoff_/24))>>8;
+  if(freq*2>m_sampling_freq)
+    freq=m_sampling_freq/2;
+  float r=float(m_sampling_freq)/(6.28318531f*float(freq));
+  float damping=1.0f/fast_exp2(float(resonance_)*0.0311434f); // 10^(-resonance*24/(128*20))
+  float d=(1.0f-2.0f*damping)*r;
+  if(d>2.0f)
+    d=2.0f;
+  d=(2.0f*damping-d)/r;
+  float e=r*r;
+  float scale=16777216.0f/(1.0f+d+e);
+  coeffs_[0]=int32_t(scale+0.5f);
+  coeffs_[1]=int32_t((d+e+e)*scale+0.5f);
+  coeffs_[2]=-int32_t(e*scale+0.5f);
+}
+//----
+#endif
+
 void pmf_player::set_instrument(audio_channel &chl_, uint8_t inst_idx_, uint8_t note_idx_)
 {
   uint8_t inst_vol=0xff;
@@ -756,6 +1777,14 @@ void pmf_player::set_instrument(audio_channel &chl_, uint8_t inst_idx_, uint8_t
     chl_.inst_metadata=inst_metadata;
     inst_vol=pgm_read_byte(inst_metadata+pmfcfg_offset_inst_volume);
     panning=pgm_read_byte(inst_metadata+pmfcfg_offset_inst_panning);
+#if PMF_USE_RESONANT_FILTERS==1
+    uint8_t filter_cutoff=pgm_read_byte(inst_metadata+pmfcfg_offset_inst_filter_cutoff);
+    uint8_t filter_resonance=pgm_read_byte(inst_metadata+pmfcfg_offset_inst_filter_resonance);
+    if(filter_cutoff&0x80)
+      chl_.filter_cutoff=filter_cutoff&0x7f;
+    if(filter_resonance&0x80)
+      chl_.filter_resonance=filter_resonance&0x7f;
+#endif
     uint16_t sample_idx=pgm_read_word(inst_metadata+pmfcfg_offset_inst_sample_idx);
     uint8_t note_idx_offs=0;
     if(sample_idx>=m_num_samples)
@@ -794,13 +1823,13 @@ void pmf_player::set_instrument(audio_channel &chl_, uint8_t inst_idx_, uint8_t
   const uint8_t *smp_metadata=m_pmf_file+pgm_read_dword(m_pmf_file+pmfcfg_offset_smp_meta_offs)+inst_idx_*pmfcfg_sample_metadata_size;
   if(chl_.smp_metadata!=smp_metadata)
   {
+    chl_.smp_metadata=smp_metadata;
     chl_.sample_pos=0;
     if(chl_.sample_speed)
-      chl_.sample_speed=get_sample_speed(chl_.note_period, true);
+      chl_.sample_speed=get_sample_speed(chl_.smp_metadata, chl_.note_period, true);
   }
-  chl_.smp_metadata=smp_metadata;
   chl_.sample_volume=(uint16_t(inst_vol)*uint16_t(pgm_read_byte(chl_.smp_metadata+pmfcfg_offset_smp_volume)))>>8;
-  chl_.sample_finetune=pgm_read_word(chl_.smp_metadata+pmfcfg_offset_smp_finetune);
+  chl_.sample_finetune=pgm_read_byte(chl_.smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_baked_pitch?0:pgm_read_word(chl_.smp_metadata+pmfcfg_offset_smp_finetune);
 
   // setup panning
   if(panning==-128)
@@ -817,8 +1846,8 @@ void pmf_player::hit_note(audio_channel &chl_, uint8_t note_idx_, uint8_t sample
   chl_.note_period=get_note_period(note_idx_, chl_.sample_finetune);
   chl_.base_note_idx=note_idx_;
   if(reset_sample_pos_)
-    chl_.sample_pos=sample_start_pos_*65536;
-  chl_.sample_speed=get_sample_speed(chl_.note_period, true);
+    chl_.sample_pos=sample_pos_t(sample_start_pos_)<<(sample_pos_frc_bits+8);
+  chl_.sample_speed=get_sample_speed(chl_.smp_metadata, chl_.note_period, true);
   chl_.note_hit=reset_sample_pos_;
   if(!(chl_.fxmem_vibrato_wave&0x4))
     chl_.fxmem_vibrato_pos=0;
@@ -827,6 +1856,14 @@ void pmf_player::hit_note(audio_channel &chl_, uint8_t note_idx_, uint8_t sample
 
 void pmf_player::process_pattern_row()
 {
+  // handle song end/loop-back detected on the previous row
+  if(m_is_song_end_pending)
+  {
+    end_song();
+    if(m_is_song_stopped)
+      return;
+  }
+
   // store current track positions
   const uint8_t *current_track_poss[pmfplayer_max_channels];
   uint8_t current_track_bit_poss[pmfplayer_max_channels];
@@ -838,7 +1875,13 @@ void pmf_player::process_pattern_row()
     chl.note_hit=0;
   }
 
-  // parse row in the music pattern
+  // parse row in the music pattern (decode the whole row first for the batched row callback)
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  pmf_channel_row batch_row[pmfplayer_max_channels];
+  bool is_batch_row=m_batch_row_callback!=0;
+  if(is_batch_row)
+    process_batch_row(batch_row);
+#endif
   bool loop_pattern=false;
   uint8_t num_skip_rows=0;
   for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
@@ -847,6 +1890,18 @@ void pmf_player::process_pattern_row()
     audio_channel &chl=m_channels[ci];
     uint8_t note_idx=0xff, inst_idx=0xff, volume=0xff, effect=0xff, effect_data, sample_start_pos=0;
     bool reset_sample_pos=true;
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+    if(is_batch_row)
+    {
+      const pmf_channel_row &chl_row=batch_row[ci];
+      note_idx=chl_row.note_idx;
+      inst_idx=chl_row.inst_idx;
+      volume=chl_row.volume;
+      effect=chl_row.effect;
+      effect_data=chl_row.effect_data;
+    }
+    else
+#endif
     if(ci<m_num_processed_pattern_channels)
       process_track_row(chl, note_idx, inst_idx, volume, effect, effect_data);
     if(m_row_callback)
@@ -1010,11 +2065,16 @@ void pmf_player::process_pattern_row()
           if(effect_data<32)
             m_speed=effect_data;
           else
-            m_num_batch_samples=(m_sampling_freq*125)/long(effect_data*50);
+          {
+            m_tempo=effect_data;
+            update_batch_samples();
+          }
         } break;
 
         case pmffx_position_jump:
         {
+          if(effect_data<=m_current_pattern_playlist_pos)
+            m_is_song_end_pending=true;
           m_current_pattern_playlist_pos=effect_data-1;
           m_current_pattern_row_idx=m_current_pattern_last_row;
         } break;
@@ -1099,7 +2159,7 @@ void pmf_player::process_pattern_row()
         case pmffx_set_sample_offset:
         {
           sample_start_pos=effect_data;
-          chl.sample_pos=effect_data*long(65536);
+          chl.sample_pos=sample_pos_t(effect_data)<<(sample_pos_frc_bits+8);
         } break;
 
         case pmffx_subfx:
@@ -1122,7 +2182,7 @@ void pmf_player::process_pattern_row()
             case pmfsubfx_set_vibrato_wave:
             {
               uint8_t wave=effect_data&3;
-              chl.fxmem_vibrato_wave=(wave<3?wave:m_batch_pos%3)|(effect_data&4);
+              chl.fxmem_vibrato_wave=(wave<3?wave:m_num_batch_samples%3)|(effect_data&4);
             } break;
 
             case pmfsubfx_set_tremolo_wave:
@@ -1176,6 +2236,14 @@ void pmf_player::process_pattern_row()
               chl.fxmem_note_delay_idx=note_idx;
               note_idx=0xff;
             } break;
+
+            default:
+            {
+#if PMF_USE_RESONANT_FILTERS==1
+              if((effect_data>>4)>=pmfsubfx_set_filter_cutoff)
+                chl.filter_cutoff=effect_data-(pmfsubfx_set_filter_cutoff<<4);
+#endif
+            } break;
           }
         } break;
 
@@ -1215,7 +2283,7 @@ void pmf_player::process_pattern_row()
     if(note_idx!=0xff)
       hit_note(chl, note_idx, sample_start_pos, reset_sample_pos);
     else if(update_sample_speed && chl.sample_speed)
-      chl.sample_speed=get_sample_speed(chl.note_period, chl.sample_speed>=0);
+      chl.sample_speed=get_sample_speed(chl.smp_metadata, chl.note_period, chl.sample_speed>=0);
   }
 
   // check for pattern loop
@@ -1236,7 +2304,10 @@ void pmf_player::process_pattern_row()
   {
     // proceed to the next pattern
     if(++m_current_pattern_playlist_pos==pgm_read_word(m_pmf_file+pmfcfg_offset_playlist_length))
+    {
       m_current_pattern_playlist_pos=0;
+      m_is_song_end_pending=true;
+    }
     init_pattern(m_current_pattern_playlist_pos, num_skip_rows);
   }
 }
@@ -1328,6 +2399,107 @@ void pmf_player::process_track_row(audio_channel &chl_, uint8_t &note_idx_, uint
 }
 //----
 
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+void pmf_player::process_batch_row(pmf_channel_row *row_)
+{
+  // decode the row of all channels
+  pmf_channel_mask_t row_data_mask=0;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    pmf_channel_row &chl_row=row_[ci];
+    chl_row.note_idx=chl_row.inst_idx=chl_row.volume=chl_row.effect=0xff;
+    chl_row.effect_data=0;
+    if(ci<m_num_processed_pattern_channels)
+    {
+      process_track_row(m_channels[ci], chl_row.note_idx, chl_row.inst_idx, chl_row.volume, chl_row.effect, chl_row.effect_data);
+      if((chl_row.note_idx&chl_row.inst_idx&chl_row.volume&chl_row.effect)!=0xff)
+        row_data_mask|=pmf_channel_mask_t(1)<<ci;
+    }
+  }
+
+  // pass the row to the callback if there's data on channels of interest and discard invalid custom notes and instruments
+  if(!(row_data_mask&m_batch_row_interest_mask))
+    return;
+  (*m_batch_row_callback)(m_batch_row_callback_custom_data, row_, m_num_playback_channels);
+  uint8_t num_instruments=m_num_instruments?m_num_instruments:m_num_samples;
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    pmf_channel_row &chl_row=row_[ci];
+    if(chl_row.note_idx>pmfcfg_note_cut && chl_row.note_idx!=pmfcfg_note_off)
+      chl_row.note_idx=0xff;
+    if(chl_row.inst_idx>=num_instruments)
+      chl_row.inst_idx=0xff;
+  }
+}
+//----
+#endif
+
+void pmf_player::init_song(uint16_t playlist_pos_)
+{
+  // initialize channels
+  memset(m_channels, 0, sizeof(m_channels));
+  uint16_t playlist_len=pgm_read_word(m_pmf_file+pmfcfg_offset_playlist_length);
+  for(unsigned ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    audio_channel &chl=m_channels[ci];
+    chl.sample_panning=pgm_read_byte(m_pmf_file+pmfcfg_offset_playlist+playlist_len+ci);
+    chl.fxmem_vol_slide_spd=pmffx_volsldtype_down|0x01;
+    chl.vol_env.value=0xffff;
+    chl.pitch_env.value=0x8000;
+#if PMF_USE_RESONANT_FILTERS==1
+    chl.filter_cutoff=127;
+#endif
+  }
+
+  // init song state
+  m_num_processed_pattern_channels=min(m_num_pattern_channels, uint8_t(m_num_playback_channels-m_num_sfx_channels));
+  init_pattern(playlist_pos_<playlist_len?playlist_pos_:0);
+  m_speed=pgm_read_byte(m_pmf_file+pmfcfg_offset_init_speed);
+  m_note_period_min=pgm_read_word(m_pmf_file+pmfcfg_offset_note_period_min);
+  m_note_period_max=pgm_read_word(m_pmf_file+pmfcfg_offset_note_period_max);
+  m_tempo=pgm_read_byte(m_pmf_file+pmfcfg_offset_init_tempo);
+  update_batch_samples();
+  m_current_row_tick=m_speed-1;
+  m_arpeggio_counter=0;
+  m_pattern_delay=1;
+  m_is_song_end_pending=false;
+  m_is_song_stopped=false;
+}
+//----
+
+void pmf_player::end_song()
+{
+  // notify the end of the song (the callback may stage the next song)
+  m_is_song_end_pending=false;
+  if(m_song_end_callback)
+    (*m_song_end_callback)(m_song_end_callback_custom_data);
+
+  // start the staged song at this tick (grow playback channels for the song and keep sound effect channels last)
+  if(m_next_pmf_file)
+  {
+    init_pmf_file(m_next_pmf_file);
+    unsigned num_channels=m_num_pattern_channels+m_num_sfx_channels;
+    if(num_channels>m_num_playback_channels)
+      m_num_playback_channels=uint8_t(min(num_channels, unsigned(pmfplayer_max_channels)));
+    init_song(m_next_playlist_pos);
+    m_next_pmf_file=0;
+    return;
+  }
+
+  if(m_song_end_action==pmfsongend_stop)
+    stop_song();
+}
+//----
+
+void pmf_player::stop_song()
+{
+  // stop all channels and let the mixer stop playback once the song has been played out
+  for(unsigned ci=0; ci<m_num_playback_channels; ++ci)
+    m_channels[ci].sample_speed=0;
+  m_is_song_stopped=true;
+}
+//----
+
 void pmf_player::init_pattern(uint8_t playlist_pos_, uint8_t row_)
 {
   // set state
@@ -36,34 +36,99 @@
 // interface
 //============================================================================
 // external
+#if defined(ARDUINO)
 #include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#define PROGMEM
+#define pgm_read_byte(addr__) pmf_read_pmem<uint8_t>(addr__)
+#define pgm_read_word(addr__) pmf_read_pmem<uint16_t>(addr__)
+#define pgm_read_dword(addr__) pmf_read_pmem<uint32_t>(addr__)
+template<typename T> inline T pmf_read_pmem(const void *addr_) {T v; memcpy(&v, addr_, sizeof(T)); return v;}
+template<typename T> inline T pmf_read_pmem(size_t addr_) {return pmf_read_pmem<T>((const void*)addr_);}
+template<typename T, typename U> inline T min(T a_, U b_) {return a_<T(b_)?a_:T(b_);}
+template<typename T, typename U> inline T max(T a_, U b_) {return a_>T(b_)?a_:T(b_);}
+uint32_t micros(); // implemented in pmf_player_host.cpp
+#endif
 #include "pmf_data.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__)
+#define PMF_ATOMIC_LOAD(var__) __atomic_load_n(&(var__), __ATOMIC_ACQUIRE)
+#define PMF_ATOMIC_STORE(var__, val__) __atomic_store_n(&(var__), val__, __ATOMIC_RELEASE)
+#define PMF_ACQUIRE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define PMF_RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define PMF_ATOMIC_LOAD(var__) (*(volatile uint8_t*)&(var__))
+#define PMF_ATOMIC_STORE(var__, val__) (*(volatile uint8_t*)&(var__)=(val__))
+#define PMF_ACQUIRE_FENCE()
+#define PMF_RELEASE_FENCE()
+#endif
 
 // new
 struct pmf_channel_info;
+struct pmf_channel_row;
+struct pmf_player_state;
 struct pmf_mixer_buffer;
+struct pmf_host_mixer;
 class pmf_player;
-template<typename T, unsigned buffer_size> struct pmf_audio_buffer;
+template<typename T, unsigned buffer_size, unsigned sample_bits> struct pmf_audio_buffer;
 typedef void(*pmf_row_callback_t)(void *custom_data_, uint8_t channel_idx_, uint8_t &note_idx_, uint8_t &inst_idx_, uint8_t &volume_, uint8_t &effect_, uint8_t &effect_data_);
+typedef void(*pmf_batch_row_callback_t)(void *custom_data_, pmf_channel_row *row_, uint8_t num_channels_);
 typedef void(*pmf_tick_callback_t)(void *custom_data_);
+typedef void(*pmf_song_end_callback_t)(void *custom_data_);
 //---------------------------------------------------------------------------
 
 
 //===========================================================================
 // PMF player config
 //===========================================================================
-enum {pmfplayer_max_channels=12};        // maximum number of audio playback channels (reduce to save dynamic memory)
+enum {pmfplayer_max_channels=12};        // maximum number of audio playback channels (reduce to save dynamic memory, max 64)
+enum {pmfplayer_tick_queue_size=1};     // number of sequenced ticks queued ahead of mixing (increase when sequencing on a separate thread)
+enum {pmfplayer_governor_max_load=90};   // quality governor steps quality down when update() takes more than this percentage of the sub-buffer playback time
+enum {pmfplayer_governor_min_load=60};   // quality governor steps quality up when update() takes less than this percentage of the sub-buffer playback time
+enum {pmfplayer_echo_delay=4096};        // echo delay in mixed samples (the set_echo() delay buffer needs this many int16_t values per output channel)
+enum {pmfplayer_sfx_queue_size=4};       // number of play_sfx() requests queued for the next mixed sub-buffer
+enum {pmfplayer_command_queue_size=4};   // number of post_command() commands queued for the next sequenced tick
 #define PMF_USE_STEREO_MIXING 1          // use stereo mixing if supported (interleaved in the audio output buffer)
 #define PMF_USE_LINEAR_INTERPOLATION 0   // interpolate samples linearly for better sound quality (more performanmce intensive)
+#define PMF_USE_KERNEL_INTERPOLATION 0   // interpolate samples with 4-tap cubic (4) or 8-tap windowed sinc (8) kernel for files converted with -pad (host & Teensy 4 only)
+#define PMF_USE_SAMPLE_MIPMAPS 0         // play high notes from octave-down copies of samples in files converted with -mip (less aliasing & memory traffic, not supported on AVR)
+#define PMF_USE_RESONANT_FILTERS 0       // apply IT resonant low-pass filters (instrument filters & Zxx cutoff) per channel (not supported on AVR)
+#define PMF_USE_ECHO 0                   // mix per-channel echo sends through a shared delay line once per mixed sub-buffer (see set_echo(), not supported on AVR)
+#define PMF_USE_CHANNEL_METERS 0         // track peak & RMS levels of each channel per mixed sub-buffer in the mixer (see channel_info(), not supported on AVR)
+#define PMF_USE_STATE_SNAPSHOTS 0        // publish double-buffered player & channel state once per tick for reading from other threads/cores (see read_state())
+#define PMF_USE_BATCH_ROW_CALLBACK 0     // pass whole pattern rows to a callback (see set_batch_row_callback(), adds the row data to the stack of the sequencer)
+#define PMF_USE_QUALITY_GOVERNOR 0       // reduce mixing quality (interpolation, quietest channels) when update() can't keep up with the playback
+#define PMF_MIXING_RATE_DIVIDER 1        // mix at 1/1, 1/2 or 1/4 of the output sampling frequency and upsample in playback (less performance intensive)
+#define PMF_USE_LINEAR_UPSAMPLING 1      // interpolate upsampled output linearly (0=hold samples)
+#define PMF_USE_WIDE_SAMPLE_POS 0        // use 32.32fp sample position & 16.16fp sample speed for higher pitch precision at high sampling rates (not supported on AVR)
+#define PMF_USE_FLOAT_MIXING 1           // mix in 32-bit float on host without clipping until the output conversion (integer mixing otherwise)
 #define PFC_USE_SGTL5000_AUDIO_SHIELD 0  // enable playback through SGTL5000-based audio shield (Teensy)
 #define PMF_USE_SERIAL_LOGS 0            // enable logging to serial output (disable to save memory)
+enum {pmfplayer_host_mixer_threads=4};   // maximum number of threads mixing channels on host (1=mix on the calling thread only)
+enum {pmfplayer_host_thread_channels=4}; // minimum number of audible channels per mixer thread on host
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// pmf_channel_mask_t
+//===========================================================================
+template<bool wide> struct pmf_channel_mask_type {typedef uint32_t type;};
+template<> struct pmf_channel_mask_type<true> {typedef uint64_t type;};
+typedef pmf_channel_mask_type<(pmfplayer_max_channels>32)>::type pmf_channel_mask_t; // bit per channel
 //---------------------------------------------------------------------------
 
 
 //===========================================================================
 // logging
 //===========================================================================
-#if PMF_USE_SERIAL_LOGS==1
+#if PMF_USE_SERIAL_LOGS==1 && !defined(ARDUINO)
+#define PMF_SERIAL_LOG(...) printf(__VA_ARGS__)
+#elif PMF_USE_SERIAL_LOGS==1
 #define PMF_SERIAL_LOG(...) {char buf[64]; sprintf(buf, __VA_ARGS__); Serial.print(buf);}
 #else
 #define PMF_SERIAL_LOG(...)
@@ -107,6 +172,35 @@ enum e_pmf_subfx
   pmfsubfx_pattern_loop,     // [0, 15], 0=set loop start, >0 = loop N times from loop start
   pmfsubfx_note_cut,         // [0, 15], cut on X tick
   pmfsubfx_note_delay,       // [0, 15], delay X ticks
+  pmfsubfx_set_filter_cutoff=8, // [0, 127], sub-effects 8-15 store the upper 3 bits of the resonant filter cutoff
+};
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// e_pmf_song_end_action
+//===========================================================================
+enum e_pmf_song_end_action
+{
+  pmfsongend_loop, // continue playback from the loop position (default)
+  pmfsongend_stop, // stop playback once the song has ended
+};
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// e_pmf_command
+//===========================================================================
+enum e_pmf_command
+{
+  pmfcmd_set_master_volume,     // param0=volume
+  pmfcmd_fade_to,               // param0=volume, param1=duration (ms)
+  pmfcmd_set_tempo_scale,       // param0=scale (8.8 fp)
+  pmfcmd_set_pitch_scale,       // param0=scale (8.8 fp)
+  pmfcmd_set_channel_mute_mask, // param0=mask
+  pmfcmd_set_channel_solo_mask, // param0=mask
+  pmfcmd_seek,                  // param0=playlist position, param1=pattern row
+  pmfcmd_stop,                  // stop playback at the tick
 };
 //---------------------------------------------------------------------------
 
@@ -121,10 +215,49 @@ struct pmf_channel_info
   uint8_t effect;
   uint8_t effect_data;
   uint8_t note_hit;
+#if PMF_USE_CHANNEL_METERS==1
+  uint8_t level_peak; // peak level of the channel in the last mixed sub-buffer ([0, 128], 128=full scale)
+  uint8_t level_rms;  // RMS level of the channel in the last mixed sub-buffer ([0, 128])
+#endif
 };
 //---------------------------------------------------------------------------
 
 
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+//===========================================================================
+// pmf_channel_row
+//===========================================================================
+struct pmf_channel_row
+{
+  // row data of a channel for the batched row callback (0xff=no data)
+  uint8_t note_idx;
+  uint8_t inst_idx;
+  uint8_t volume;
+  uint8_t effect;
+  uint8_t effect_data;
+};
+//---------------------------------------------------------------------------
+#endif
+
+
+//===========================================================================
+// pmf_player_state
+//===========================================================================
+#if PMF_USE_STATE_SNAPSHOTS==1
+struct pmf_player_state
+{
+  uint16_t tick_count;   // number of sequenced ticks (wraps around)
+  uint8_t playlist_pos;
+  uint8_t pattern_row;
+  uint8_t pattern_tick;  // tick within the row ([0, pattern_speed-1])
+  uint8_t pattern_speed;
+  uint8_t num_channels;
+  pmf_channel_info channels[pmfplayer_max_channels];
+};
+#endif
+//---------------------------------------------------------------------------
+
+
 //===========================================================================
 // pmf_mixer_buffer
 //===========================================================================
@@ -132,6 +265,9 @@ struct pmf_mixer_buffer
 {
   void *begin;
   unsigned num_samples;
+#if PMF_USE_ECHO==1
+  void *echo_send; // echo send output mixed in parallel with begin (same format)
+#endif
 };
 //---------------------------------------------------------------------------
 
@@ -147,8 +283,24 @@ public:
   ~pmf_player();
   void load(const void *pmem_pmf_file_);
   void enable_playback_channels(uint8_t num_channels_);
+  void enable_sfx_channels(uint8_t num_channels_);
   void set_row_callback(pmf_row_callback_t, void *custom_data_=0);
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  void set_batch_row_callback(pmf_batch_row_callback_t, void *custom_data_=0, pmf_channel_mask_t interest_mask_=pmf_channel_mask_t(-1));
+#endif
   void set_tick_callback(pmf_tick_callback_t, void *custom_data_=0);
+  void set_song_end_callback(pmf_song_end_callback_t, void *custom_data_=0);
+  void set_song_end_action(e_pmf_song_end_action);
+  void set_channel_mute_mask(pmf_channel_mask_t channel_mask_);
+  void set_channel_solo_mask(pmf_channel_mask_t channel_mask_);
+  void set_master_volume(uint8_t volume_);
+  void fade_to(uint8_t volume_, uint16_t duration_ms_);
+  void set_tempo_scale(uint16_t scale_);
+  void set_pitch_scale(uint16_t scale_);
+#if PMF_USE_ECHO==1
+  void set_echo(int16_t *delay_buffer_, uint8_t feedback_=128, uint8_t level_=128);
+  void set_channel_echo_send(uint8_t channel_idx_, uint8_t send_level_);
+#endif
   //-------------------------------------------------------------------------
 
   // PMF accessors
@@ -158,9 +310,17 @@ public:
   //-------------------------------------------------------------------------
 
   // player control
+  uint32_t calibrate_sampling_freq(const uint32_t *sampling_freqs_, uint8_t num_sampling_freqs_, uint8_t cpu_margin_=25);
   void start(uint32_t sampling_freq_=22050, uint16_t playlist_pos_=0);
   void stop();
   void update();
+  void enable_sequencer_thread(bool enable_=true);
+  void update_sequencer();
+  bool set_next_song(const void *pmem_pmf_file_, uint16_t playlist_pos_=0);
+  void attach_layer(pmf_player &layer_);
+  void detach_layer(pmf_player &layer_);
+  bool play_sfx(uint8_t sample_idx_, uint8_t note_idx_, uint8_t volume_=255, int8_t panning_=0, uint8_t priority_=0);
+  bool post_command(e_pmf_command, pmf_channel_mask_t param0_=0, uint16_t param1_=0);
   //-------------------------------------------------------------------------
 
   // playback state accessors
@@ -168,20 +328,114 @@ public:
   uint8_t playlist_pos() const;
   uint8_t pattern_row() const;
   uint8_t pattern_speed() const;
+  uint8_t quality_level() const;
   pmf_channel_info channel_info(uint8_t channel_idx_) const;
+#if PMF_USE_STATE_SNAPSHOTS==1
+  void read_state(pmf_player_state&) const;
+#endif
+  pmf_channel_mask_t channel_mute_mask() const;
+  pmf_channel_mask_t channel_solo_mask() const;
+  uint8_t master_volume() const;
+  uint16_t tempo_scale() const;
+  uint16_t pitch_scale() const;
   //-------------------------------------------------------------------------
 
+#if !defined(ARDUINO)
+  // host rendering (implemented in pmf_player_host.cpp)
+  void render(int16_t *samples_, unsigned num_samples_);
+  void render(float *samples_, unsigned num_samples_);
+  //-------------------------------------------------------------------------
+#endif
+
 private:
   struct envelope_state;
   struct audio_channel;
+  struct mixer_voice;
+  struct voice_params;
+  struct player_command;
+  struct tick_snapshot;
+  struct sfx_request;
+#if PMF_USE_WIDE_SAMPLE_POS==1
+  typedef uint64_t sample_pos_t;   // 32.32 fp
+  typedef int64_t sample_step_t;
+  typedef int32_t sample_speed_t;  // 16.16 fp
+  enum {sample_pos_frc_bits=32, sample_speed_frc_bits=16};
+#else
+  typedef uint32_t sample_pos_t;   // 24.8 fp
+  typedef int32_t sample_step_t;
+  typedef int16_t sample_speed_t;  // 8.8 fp
+  enum {sample_pos_frc_bits=8, sample_speed_frc_bits=8};
+#endif
+  enum {sample_step_shift=sample_pos_frc_bits-sample_speed_frc_bits};
+  enum e_mixer_interpolation
+  {
+    mixinterp_none,
+    mixinterp_linear,
+    mixinterp_kernel,
+  };
+#if defined(ARDUINO_ARCH_AVR)
+  enum {mixer_bidi_loops=false}; // bidi loops aren't supported by the AVR mixer
+#else
+  enum {mixer_bidi_loops=true};
+#endif
   // platform specific functions (implemented in platform specific files)
   uint32_t get_sampling_freq(uint32_t sampling_freq_) const;
   void start_playback(uint32_t sampling_freq_);
   void stop_playback();
   void mix_buffer(pmf_mixer_buffer&, unsigned num_samples_);
+  void mix_samples(pmf_mixer_buffer&, unsigned num_samples_);
   pmf_mixer_buffer get_mixer_buffer();
+#if !defined(ARDUINO)
+  pmf_host_mixer &get_host_mixer();
+  void release_host_mixer();
+#endif
   // platform agnostic reference functions
-  template<typename T, bool stereo=false, unsigned channel_bits=8> void mix_buffer_impl(pmf_mixer_buffer&, unsigned num_samples_);
+  template<typename T, bool stereo=false, unsigned channel_bits=8> void mix_buffer_impl(pmf_mixer_buffer&, unsigned num_samples_, pmf_channel_mask_t channel_mask_=pmf_channel_mask_t(-1));
+  template<bool stereo=false, unsigned channel_bits=8> void mix_buffer_float_impl(pmf_mixer_buffer&, unsigned num_samples_, pmf_channel_mask_t channel_mask_=pmf_channel_mask_t(-1));
+  template<typename T, bool stereo, unsigned channel_bits, e_mixer_interpolation interpolation> void mix_voices_impl(pmf_mixer_buffer&, unsigned num_samples_, pmf_channel_mask_t channel_mask_);
+  template<bool stereo, unsigned channel_bits, e_mixer_interpolation interpolation> void mix_voices_float_impl(pmf_mixer_buffer&, unsigned num_samples_, pmf_channel_mask_t channel_mask_);
+  template<typename T, bool stereo=false, unsigned channel_bits=8> void mix_layers_impl(const pmf_mixer_buffer&, unsigned num_samples_);
+  template<bool stereo=false, unsigned channel_bits=8> void mix_layers_float_impl(const pmf_mixer_buffer&, unsigned num_samples_);
+#if PMF_USE_ECHO==1
+  template<typename T, bool stereo=false, unsigned channel_bits=8> void apply_echo(const pmf_mixer_buffer&, unsigned num_samples_);
+  template<bool stereo=false, unsigned channel_bits=8> void apply_echo_float(const pmf_mixer_buffer&, unsigned num_samples_);
+#endif
+  pmf_channel_mask_t channel_mix_mask() const;
+  e_mixer_interpolation mixer_interpolation() const;
+#if PMF_USE_SAMPLE_MIPMAPS==1
+  uint8_t select_sample_mip_level(const uint8_t *smp_metadata_, sample_speed_t sample_speed_, size_t &sample_addr_) const;
+#endif
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+  static void init_interpolation_kernel();
+  static int32_t apply_interpolation_kernel(const uint8_t *smp_, uint8_t sample_pos_frc_);
+#endif
+#if PMF_USE_RESONANT_FILTERS==1
+  static int32_t apply_resonant_filter(int32_t smp_, const int32_t coeffs_[3], int32_t hist_[2]);
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+  static void update_channel_meter(int16_t level_, uint16_t &peak_, uint32_t &sum_sq_);
+  void update_channel_levels(unsigned num_samples_);
+#endif
+#if PMF_USE_QUALITY_GOVERNOR==1
+  void update_quality_governor(uint32_t update_time_us_, unsigned num_samples_);
+#endif
+  void update_master_fade(unsigned num_samples_);
+  void advance_sample_pos(const uint8_t *smp_metadata_, sample_pos_t &sample_pos_, sample_speed_t &sample_speed_, unsigned num_samples_);
+  // PMF file & song setup
+  static bool is_valid_pmf_file(const uint8_t *pmf_file_);
+  void init_pmf_file(const uint8_t *pmf_file_);
+  void init_song(uint16_t playlist_pos_);
+  void end_song();
+  void stop_song();
+  // sequencer/mixer tick queue
+  void sequence_tick();
+  bool apply_queued_tick();
+  void apply_queued_sfx();
+  void apply_queued_commands(tick_snapshot&);
+  void apply_mixer_command(const player_command&);
+#if PMF_USE_STATE_SNAPSHOTS==1
+  void publish_state();
+#endif
   // audio effects
   void apply_channel_effect_volume_slide(audio_channel&);
   void apply_channel_effect_note_slide(audio_channel&);
@@ -193,12 +447,20 @@ private:
   void evaluate_envelope(envelope_state&, uint16_t env_data_offs_, bool is_note_off_);
   void evaluate_envelopes();
   // pattern playback
+  void update_batch_samples();
   uint16_t get_note_period(uint8_t note_idx_, int16_t finetune_);
-  int16_t get_sample_speed(uint16_t note_period_, bool forward_);
+  sample_speed_t get_sample_speed(uint16_t note_period_, bool forward_);
+  sample_speed_t get_sample_speed(const uint8_t *smp_metadata_, uint16_t note_period_, bool forward_);
+#if PMF_USE_RESONANT_FILTERS==1
+  void get_filter_coeffs(int32_t coeffs_[3], uint8_t cutoff_, uint8_t resonance_);
+#endif
   void set_instrument(audio_channel&, uint8_t inst_idx_, uint8_t note_idx_);
   void hit_note(audio_channel&, uint8_t note_idx_, uint8_t sample_start_pos_, bool reset_sample_pos_);
   void process_pattern_row();
   void process_track_row(audio_channel&, uint8_t &note_idx_, uint8_t &inst_idx_, uint8_t &volume_, uint8_t &effect_, uint8_t &effect_data_);
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  void process_batch_row(pmf_channel_row*);
+#endif
   void init_pattern(uint8_t playlist_pos_, uint8_t row_=0);
   //-------------------------------------------------------------------------
 
@@ -231,8 +493,8 @@ private:
     // sample playback
     const uint8_t *inst_metadata;
     const uint8_t *smp_metadata;
-    uint32_t sample_pos;           // sample position (24.8 fp)
-    int16_t sample_speed;          // sample speed (8.8 fp)
+    sample_pos_t sample_pos;       // predicted sample position of the mixer voice (24.8 fp, or 32.32 fp for wide sample pos)
+    sample_speed_t sample_speed;   // predicted sample speed of the mixer voice (8.8 fp, or 16.16 fp for wide sample pos)
     int16_t sample_finetune;       // sample finetune (9.7 fp)
     uint16_t note_period;          // current note period
     uint8_t sample_volume;         // sample volume (0.8 fp)
@@ -257,6 +519,87 @@ private:
     uint16_t vol_fadeout;          // fadeout volume
     envelope_state vol_env;        // volume envelope
     envelope_state pitch_env;      // pitch envelope
+#if PMF_USE_RESONANT_FILTERS==1
+    uint8_t filter_cutoff;         // resonant filter cutoff [0, 127] (127 with 0 resonance = bypass)
+    uint8_t filter_resonance;      // resonant filter resonance [0, 127]
+#endif
+  };
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // mixer_voice
+  //=========================================================================
+  struct mixer_voice
+  {
+    const uint8_t *smp_metadata;
+    sample_pos_t sample_pos;       // sample position (owned by the mixer)
+    sample_speed_t sample_speed;   // sample speed (sign = playback direction owned by the mixer, 0=inactive)
+    uint8_t volume;                // sample volume with volume envelope applied (0.8 fp)
+    int8_t panning;                // sample panning (-127=left, 0=center, 127=right, -128=surround)
+#if PMF_USE_RESONANT_FILTERS==1
+    int32_t filter_coeffs[3];      // resonant filter coefficients (8.24 fp, 0=bypass)
+    int32_t filter_hist[2];        // resonant filter output history (24.8 fp, owned by the mixer)
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+    uint16_t meter_peak;           // peak level mixed in the current sub-buffer
+    uint32_t meter_sum_sq;         // sum of squared levels mixed in the current sub-buffer
+#endif
+  };
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // voice_params
+  //=========================================================================
+  struct voice_params
+  {
+    const uint8_t *smp_metadata;
+    sample_pos_t sample_pos;       // sample position (applied only if the voice is reset)
+    sample_speed_t sample_speed;   // sample speed (only magnitude is applied unless the voice is reset, 0=stop)
+    uint8_t volume;
+    int8_t panning;
+#if PMF_USE_RESONANT_FILTERS==1
+    int32_t filter_coeffs[3];
+#endif
+  };
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // player_command
+  //=========================================================================
+  struct player_command
+  {
+    pmf_channel_mask_t param0; // wide enough for channel masks of all channels
+    uint16_t param1;
+    uint8_t type; // e_pmf_command
+  };
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // tick_snapshot
+  //=========================================================================
+  struct tick_snapshot
+  {
+    const uint8_t *pmf_file;                 // PMF file of the voice samples
+    uint16_t num_samples;                    // number of samples to mix for the tick
+    bool is_song_stopped;                    // song has stopped at the end (playback is stopped after mixing)
+    uint8_t num_channels;                    // number of playback channels sequenced for the tick
+    pmf_channel_mask_t voice_reset_mask;     // voices (re)started by the sequencer
+    uint8_t num_commands;                    // number of mixer commands applied at the tick
+    player_command commands[pmfplayer_command_queue_size];
+    voice_params voices[pmfplayer_max_channels];
+  };
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // sfx_request
+  //=========================================================================
+  struct sfx_request
+  {
+    const uint8_t *smp_metadata;
+    sample_speed_t sample_speed;
+    uint8_t volume;
+    int8_t panning;
+    uint8_t priority;
   };
   //-------------------------------------------------------------------------
 
@@ -265,11 +608,22 @@ private:
   uint32_t m_sampling_freq;
   pmf_row_callback_t m_row_callback;
   void *m_row_callback_custom_data;
+#if PMF_USE_BATCH_ROW_CALLBACK==1
+  pmf_batch_row_callback_t m_batch_row_callback;
+  void *m_batch_row_callback_custom_data;
+  pmf_channel_mask_t m_batch_row_interest_mask;
+#endif
   pmf_tick_callback_t m_tick_callback;
   void *m_tick_callback_custom_data;
+  pmf_song_end_callback_t m_song_end_callback;
+  void *m_song_end_callback_custom_data;
+  const uint8_t *m_next_pmf_file;
+  uint16_t m_next_playlist_pos;
   uint16_t m_pmf_flags;  // e_pmf_flags
   uint16_t m_note_period_min;
   uint16_t m_note_period_max;
+  uint16_t m_tempo_scale;  // tempo multiplier (8.8 fp)
+  uint16_t m_pitch_scale;  // pitch multiplier (8.8 fp)
   uint8_t m_note_slide_speed;
   uint8_t m_num_pattern_channels;
   uint8_t m_num_instruments;
@@ -277,65 +631,352 @@ private:
   // audio channel states
   uint8_t m_num_playback_channels;
   uint8_t m_num_processed_pattern_channels;
+  uint8_t m_num_sfx_channels; // last playback channels reserved for sound effects
+  pmf_channel_mask_t m_channel_mute_mask;
+  pmf_channel_mask_t m_channel_solo_mask;
   audio_channel m_channels[pmfplayer_max_channels];
-  // audio buffer state
+  pmf_channel_mask_t m_voice_reset_mask;
+  // sequencer/mixer tick queue
+  tick_snapshot m_tick_queue[pmfplayer_tick_queue_size];
+  uint8_t m_tick_queue_write_count;
+  uint8_t m_tick_queue_read_count;
+  bool m_sequencer_thread;
+#if PMF_USE_STATE_SNAPSHOTS==1
+  // double-buffered state snapshot
+  pmf_player_state m_states[2];
+  uint8_t m_state_seq; // sequence count of the last published state (m_states[m_state_seq&1])
+#endif
+  // command queue
+  player_command m_command_queue[pmfplayer_command_queue_size];
+  uint8_t m_command_queue_write_count;
+  uint8_t m_command_queue_read_count;
+  // sound effect queue
+  sfx_request m_sfx_queue[pmfplayer_sfx_queue_size];
+  uint8_t m_sfx_queue_write_count;
+  uint8_t m_sfx_queue_read_count;
+  // layered playback
+  pmf_player *m_layer_owner; // player owning the audio output of the layer (0=not a layer)
+  pmf_player *m_next_layer;  // next layer mixed to the audio output of the owner
+#if !defined(ARDUINO)
+  pmf_host_mixer *m_host_mixer; // render buffers and mixer threads of the player on host (allocated on the first use)
+#endif
+  // mixer state
+  const uint8_t *m_mix_pmf_file;
+  bool m_is_mix_stopped;
+  uint8_t m_sfx_priorities[pmfplayer_max_channels]; // priorities of sound effects playing on the channels
+  uint16_t m_sfx_start_counts[pmfplayer_max_channels]; // sound effect start count at the time of starting the channel sound effect (for age)
+  uint16_t m_sfx_start_count;
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+  static int16_t s_interpolation_kernel[256][PMF_USE_KERNEL_INTERPOLATION]; // 2.14fp taps per 8-bit sample position fraction
+#endif
+  mixer_voice m_voices[pmfplayer_max_channels];
   uint16_t m_num_batch_samples;
-  uint16_t m_batch_pos;
+  uint16_t m_tick_samples_left;
+  uint32_t m_master_volume;      // master volume (8.24 fp, 1.0=full)
+  uint32_t m_master_fade_target; // master volume fade target (8.24 fp)
+  int32_t m_master_fade_step;    // master volume change per mixed sample (8.24 fp, 0=no fade)
+  uint16_t m_master_gain;        // master volume folded into voice volumes by the mixer ([0, 256])
+#if PMF_USE_QUALITY_GOVERNOR==1
+  uint8_t m_quality_level;
+  pmf_channel_mask_t m_quality_drop_mask;
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+  uint8_t m_channel_level_peaks[pmfplayer_max_channels];
+  uint8_t m_channel_level_rms[pmfplayer_max_channels];
+#endif
+#if PMF_USE_ECHO==1
+  int16_t *m_echo_buffer;
+  unsigned m_echo_pos;
+  uint8_t m_echo_feedback;
+  uint8_t m_echo_level;
+  uint8_t m_echo_sends[pmfplayer_max_channels];
+#endif
   // pattern playback state
   uint16_t m_current_pattern_playlist_pos;
   uint8_t m_current_pattern_last_row;
   uint8_t m_current_pattern_row_idx;
   uint8_t m_current_row_tick;
   uint8_t m_speed;
+  uint8_t m_tempo;
   uint8_t m_arpeggio_counter;
   uint8_t m_pattern_delay;
   uint8_t m_pattern_loop_cnt;
   uint8_t m_pattern_loop_row_idx;
+  uint8_t m_song_end_action; // e_pmf_song_end_action
+  bool m_is_song_end_pending;
+  bool m_is_song_stopped;
 };
 //---------------------------------------------------------------------------
 
+inline pmf_player::e_mixer_interpolation pmf_player::mixer_interpolation() const
+{
+  // select sample interpolation for mixing (the quality governor drops kernel interpolation first)
+#if PMF_USE_QUALITY_GOVERNOR==1
+  uint8_t level=m_quality_level;
+#else
+  uint8_t level=0;
+#endif
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+  if(m_pmf_flags&pmfflag_padded_samples)
+  {
+    if(!level)
+      return mixinterp_kernel;
+    --level;
+  }
+#endif
+  return PMF_USE_LINEAR_INTERPOLATION==1 && !level?mixinterp_linear:mixinterp_none;
+}
+//----
+
+#if PMF_USE_SAMPLE_MIPMAPS==1
+inline uint8_t pmf_player::select_sample_mip_level(const uint8_t *smp_metadata_, sample_speed_t sample_speed_, size_t &sample_addr_) const
+{
+  // select the first mip level with sample speed <=1.0 and advance the sample address to the level data
+  uint8_t num_levels=(pgm_read_byte(smp_metadata_+pmfcfg_offset_smp_flags)&pmfsmpflag_mip_levels)>>pmfcfg_sample_mip_levels_shift;
+  uint32_t speed=sample_speed_<0?uint32_t(-int32_t(sample_speed_)):uint32_t(sample_speed_);
+  uint32_t len=pgm_read_dword(smp_metadata_+pmfcfg_offset_smp_length);
+  uint8_t pad=m_pmf_flags&pmfflag_padded_samples?pmfcfg_sample_pad_pre+pmfcfg_sample_pad_post:1;
+  uint8_t level=0;
+  while(level<num_levels && (speed>>level)>(uint32_t(1)<<sample_speed_frc_bits))
+    sample_addr_+=(len>>level++)+pad;
+  return level;
+}
+//----
+#endif
+
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+inline int32_t pmf_player::apply_interpolation_kernel(const uint8_t *smp_, uint8_t sample_pos_frc_)
+{
+  // convolve padded sample data around the position with the kernel taps (returns 2.14fp sample)
+  enum {num_taps=PMF_USE_KERNEL_INTERPOLATION};
+  const int16_t *taps=s_interpolation_kernel[sample_pos_frc_];
+  smp_-=num_taps/2-1;
+#if defined(__SSE2__)
+  __m128i data;
+  if(num_taps==8)
+    data=_mm_loadl_epi64((const __m128i*)smp_);
+  else
+  {
+    int32_t v;
+    memcpy(&v, smp_, 4);
+    data=_mm_cvtsi32_si128(v);
+  }
+  data=_mm_srai_epi16(_mm_unpacklo_epi8(data, data), 8);
+  __m128i res=_mm_madd_epi16(data, num_taps==8?_mm_loadu_si128((const __m128i*)taps):_mm_loadl_epi64((const __m128i*)taps));
+  if(num_taps==8)
+    res=_mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+  res=_mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(res);
+#elif defined(__ARM_FEATURE_DSP)
+  // dual 16-bit MACs of even/odd sample bytes (taps are stored in [0, 2, 1, 3] order per 4 samples)
+  int32_t res=0;
+  for(unsigned i=0; i<num_taps; i+=4)
+  {
+    uint32_t data, taps02, taps13;
+    memcpy(&data, smp_+i, 4);
+    memcpy(&taps02, taps+i, 4);
+    memcpy(&taps13, taps+i+2, 4);
+    uint32_t data02, data13;
+    asm("sxtb16 %0, %1" : "=r" (data02) : "r" (data));
+    asm("sxtb16 %0, %1, ror #8" : "=r" (data13) : "r" (data));
+    asm("smlad %0, %1, %2, %0" : "+r" (res) : "r" (data02), "r" (taps02));
+    asm("smlad %0, %1, %2, %0" : "+r" (res) : "r" (data13), "r" (taps13));
+  }
+  return res;
+#else
+  int32_t res=0;
+  for(unsigned i=0; i<num_taps; ++i)
+    res+=int32_t(int8_t(smp_[i]))*taps[i];
+  return res;
+#endif
+}
+#endif
+//----
+
+#if PMF_USE_CHANNEL_METERS==1
+inline void pmf_player::update_channel_meter(int16_t level_, uint16_t &peak_, uint32_t &sum_sq_)
+{
+  // accumulate absolute peak and sum of squares of a mixed sample level (8-bit sample scaled by the voice volume)
+  uint16_t abs_level=uint16_t(level_<0?-level_:level_);
+  if(abs_level>peak_)
+    peak_=abs_level;
+  sum_sq_+=uint32_t(int32_t(level_)*level_);
+}
+#endif
+//----
+
+#if PMF_USE_RESONANT_FILTERS==1
+inline int32_t pmf_player::apply_resonant_filter(int32_t smp_, const int32_t coeffs_[3], int32_t hist_[2])
+{
+  // 2-pole resonant low-pass filter (24.8 fp sample, output clamped to twice the sample range)
+  int32_t res=int32_t((int64_t(coeffs_[0])*smp_+int64_t(coeffs_[1])*hist_[0]+int64_t(coeffs_[2])*hist_[1])>>24);
+  res=res<-0x10000?-0x10000:res>0xffff?0xffff:res;
+  hist_[1]=hist_[0];
+  hist_[0]=res;
+  return res;
+}
+#endif
+//----
+
 template<typename T, bool stereo, unsigned channel_bits>
-void pmf_player::mix_buffer_impl(pmf_mixer_buffer &buf_, unsigned num_samples_)
+void pmf_player::mix_buffer_impl(pmf_mixer_buffer &buf_, unsigned num_samples_, pmf_channel_mask_t channel_mask_)
 {
-  audio_channel *channel=m_channels, *channel_end=channel+m_num_playback_channels;
+  // select the mixing loop for the sample interpolation once for the buffer
+  switch(mixer_interpolation())
+  {
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+    case mixinterp_kernel: mix_voices_impl<T, stereo, channel_bits, mixinterp_kernel>(buf_, num_samples_, channel_mask_); break;
+#endif
+#if PMF_USE_LINEAR_INTERPOLATION==1
+    case mixinterp_linear: mix_voices_impl<T, stereo, channel_bits, mixinterp_linear>(buf_, num_samples_, channel_mask_); break;
+#endif
+    default: mix_voices_impl<T, stereo, channel_bits, mixinterp_none>(buf_, num_samples_, channel_mask_);
+  }
+}
+//----
+
+template<typename T, bool stereo, unsigned channel_bits, pmf_player::e_mixer_interpolation interpolation>
+void pmf_player::mix_voices_impl(pmf_mixer_buffer &buf_, unsigned num_samples_, pmf_channel_mask_t channel_mask_)
+{
+  // mix voices in channel_mask_ (other voices are left untouched for mixing in parallel)
+  mixer_voice *voice=m_voices, *voice_end=voice+m_num_playback_channels;
+  pmf_channel_mask_t mix_mask=channel_mix_mask();
+  const sample_pos_t sample_pos_frc_mask=(sample_pos_t(1)<<sample_pos_frc_bits)-1;
   do
   {
     // check for active channel
-    if(!channel->sample_speed)
+    bool is_mixed=mix_mask&1, is_included=channel_mask_&1;
+    mix_mask>>=1;
+    channel_mask_>>=1;
+    if(!is_included || !voice->sample_speed)
       continue;
 
+    // skip mixing of inaudible and muted channels (master volume is folded into the voice volume)
+    uint8_t sample_volume=uint8_t((uint16_t(voice->volume)*m_master_gain)>>8);
+    if(!sample_volume || !is_mixed)
+    {
+      advance_sample_pos(voice->smp_metadata, voice->sample_pos, voice->sample_speed, num_samples_);
+      continue;
+    }
+
     // get channel attributes
-    size_t sample_addr=(size_t)(m_pmf_file+pgm_read_dword(channel->smp_metadata+pmfcfg_offset_smp_data));
-    uint32_t sample_pos=channel->sample_pos;
-    int16_t sample_speed=channel->sample_speed;
-    uint32_t sample_end=uint32_t(pgm_read_dword(channel->smp_metadata+pmfcfg_offset_smp_length))<<8;
-    uint32_t sample_loop_len=(pgm_read_dword(channel->smp_metadata+pmfcfg_offset_smp_loop_length_and_panning)&0xffffff)<<8;
-    uint8_t sample_volume=(channel->sample_volume*(channel->vol_env.value>>8))>>8;
-    uint32_t sample_pos_offs=sample_end-sample_loop_len;
+    size_t sample_addr=(size_t)(m_mix_pmf_file+pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_data));
+    sample_pos_t sample_pos=voice->sample_pos;
+    sample_step_t sample_step=sample_step_t(voice->sample_speed)<<sample_step_shift;
+    sample_pos_t sample_end=sample_pos_t(pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_length))<<sample_pos_frc_bits;
+    sample_pos_t sample_loop_len=sample_pos_t(pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_loop_length_and_panning)&0xffffff)<<sample_pos_frc_bits;
+    sample_pos_t sample_pos_offs=sample_end-sample_loop_len;
     if(sample_pos<sample_pos_offs)
       sample_pos_offs=0;
-    sample_addr+=sample_pos_offs>>8;
+#if PMF_USE_SAMPLE_MIPMAPS==1
+    // pick octave-down copy of the sample for speeds >1.0 (sample positions stay in full sample resolution)
+    uint8_t sample_pos_shift=sample_pos_frc_bits+select_sample_mip_level(voice->smp_metadata, voice->sample_speed, sample_addr);
+    sample_pos_offs&=sample_pos_t(-1)<<sample_pos_shift;
+#else
+    const uint8_t sample_pos_shift=sample_pos_frc_bits;
+#endif
+    sample_addr+=sample_pos_offs>>sample_pos_shift;
     sample_pos-=sample_pos_offs;
     sample_end-=sample_pos_offs;
 
     // setup panning
-    int8_t panning=channel->sample_panning;
+    int8_t panning=voice->panning;
     int16_t sample_phase_shift=panning==-128?0xffff:0;
     panning&=~int8_t(sample_phase_shift);
     uint8_t sample_volume_l=uint8_t((uint16_t(sample_volume)*uint8_t(128-panning))>>8);
     uint8_t sample_volume_r=uint8_t((uint16_t(sample_volume)*uint8_t(128+panning))>>8);
 
+    // setup echo send (panned as the voice)
+#if PMF_USE_ECHO==1
+    uint8_t echo_volume=uint8_t((uint16_t(sample_volume)*m_echo_sends[voice-m_voices])>>8);
+    uint8_t echo_volume_l=uint8_t((uint16_t(echo_volume)*uint8_t(128-panning))>>8);
+    uint8_t echo_volume_r=uint8_t((uint16_t(echo_volume)*uint8_t(128+panning))>>8);
+    T *send=(T*)buf_.echo_send;
+    const bool is_sent=echo_volume && m_echo_buffer;
+#else
+    const uint8_t echo_volume=0, echo_volume_l=0, echo_volume_r=0;
+    T *send=0;
+    const bool is_sent=false;
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+    uint16_t meter_peak=voice->meter_peak;
+    uint32_t meter_sum_sq=voice->meter_sum_sq;
+#endif
+
+    // setup resonant filter
+#if PMF_USE_RESONANT_FILTERS==1
+    const int32_t filter_coeffs[3]={voice->filter_coeffs[0], voice->filter_coeffs[1], voice->filter_coeffs[2]};
+    int32_t filter_hist[2]={voice->filter_hist[0], voice->filter_hist[1]};
+    const bool is_filtered=filter_coeffs[0]!=0;
+#else
+    const bool is_filtered=false;
+#endif
+
     // mix channel to the buffer
     T *buf=(T*)buf_.begin, *buffer_end=buf+num_samples_*(stereo?2:1);
+    if(!is_filtered && sample_step==sample_step_t(1)<<sample_pos_frc_bits && !(sample_pos&sample_pos_frc_mask) && !(pgm_read_byte(voice->smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop))
+    {
+      // fast path for speed 1.0 (e.g. pitch baked samples): advance one sample byte per output sample
+      size_t smp_addr=sample_addr+size_t(sample_pos>>sample_pos_frc_bits), smp_end=sample_addr+size_t(sample_end>>sample_pos_frc_bits);
+      do
+      {
+        int16_t smp=(int8_t)pgm_read_byte(smp_addr);
+#if PMF_USE_CHANNEL_METERS==1
+        update_channel_meter(int16_t((sample_volume*smp)>>8), meter_peak, meter_sum_sq);
+#endif
+        if(stereo)
+        {
+          (*buf++)+=T(sample_volume_l*smp)>>(16-channel_bits);
+          (*buf++)+=T(sample_volume_r*(smp^sample_phase_shift))>>(16-channel_bits);
+        }
+        else
+          (*buf++)+=T(sample_volume*smp)>>(16-channel_bits);
+        if(is_sent)
+        {
+          if(stereo)
+          {
+            (*send++)+=T(echo_volume_l*smp)>>(16-channel_bits);
+            (*send++)+=T(echo_volume_r*(smp^sample_phase_shift))>>(16-channel_bits);
+          }
+          else
+            (*send++)+=T(echo_volume*smp)>>(16-channel_bits);
+        }
+        if(++smp_addr==smp_end)
+        {
+          if(!sample_loop_len)
+          {
+            voice->sample_speed=0;
+            break;
+          }
+          smp_addr-=size_t(sample_loop_len>>sample_pos_frc_bits);
+        }
+      } while(buf<buffer_end);
+      sample_pos=sample_pos_t(smp_addr-sample_addr)<<sample_pos_frc_bits;
+    }
+    else
     do
     {
-      // get sample data and adjust volume
-#if PMF_USE_LINEAR_INTERPOLATION==1
-      uint16_t smp_data=((uint16_t)pgm_read_word(sample_addr+(sample_pos>>8)));
-      uint8_t sample_pos_frc=sample_pos&255;
-      int16_t smp=((int16_t(int8_t(smp_data&255))*(256-sample_pos_frc))>>8)+((int16_t(int8_t(smp_data>>8))*sample_pos_frc)>>8);
-#else
-      int16_t smp=(int8_t)pgm_read_byte(sample_addr+(sample_pos>>8));
+      // get sample data and adjust volume (the if-branches for the interpolation template argument are optimized out)
+      int16_t smp;
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+      if(interpolation==mixinterp_kernel)
+        smp=int16_t(apply_interpolation_kernel((const uint8_t*)(sample_addr+(sample_pos>>sample_pos_shift)), uint8_t(sample_pos>>(sample_pos_shift-8)))>>14);
+      else
+#endif
+      if(interpolation==mixinterp_linear)
+      {
+        uint16_t smp_data=((uint16_t)pgm_read_word(sample_addr+(sample_pos>>sample_pos_shift)));
+        uint8_t sample_pos_frc=uint8_t(sample_pos>>(sample_pos_shift-8));
+        smp=((int16_t(int8_t(smp_data&255))*(256-sample_pos_frc))>>8)+((int16_t(int8_t(smp_data>>8))*sample_pos_frc)>>8);
+      }
+      else
+        smp=(int8_t)pgm_read_byte(sample_addr+(sample_pos>>sample_pos_shift));
+#if PMF_USE_RESONANT_FILTERS==1
+      if(is_filtered)
+        smp=int16_t(apply_resonant_filter(int32_t(smp)<<8, filter_coeffs, filter_hist)>>8);
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+      update_channel_meter(int16_t((sample_volume*smp)>>8), meter_peak, meter_sum_sq);
 #endif
 
       // mix the result to the audio buffer (the if-branch with compile-time constant will be optimized out)
@@ -346,97 +987,460 @@ void pmf_player::mix_buffer_impl(pmf_mixer_buffer &buf_, unsigned num_samples_)
       }
       else
         (*buf++)+=T(sample_volume*smp)>>(16-channel_bits);
+      if(is_sent)
+      {
+        if(stereo)
+        {
+          (*send++)+=T(echo_volume_l*smp)>>(16-channel_bits);
+          (*send++)+=T(echo_volume_r*(smp^sample_phase_shift))>>(16-channel_bits);
+        }
+        else
+          (*send++)+=T(echo_volume*smp)>>(16-channel_bits);
+      }
 
       // advance sample position
-      sample_pos+=sample_speed;
+      sample_pos+=sample_step;
       if(sample_pos>=sample_end)
       {
         // check for loop
         if(!sample_loop_len)
         {
-          channel->sample_speed=0;
+          voice->sample_speed=0;
           break;
         }
 
         // apply normal/bidi loop
-        if(pgm_read_byte(channel->smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop)
+        if(pgm_read_byte(voice->smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop)
         {
-          sample_pos-=sample_speed*2;
-          channel->sample_speed=sample_speed=-sample_speed;
+          sample_pos-=sample_step*2;
+          sample_step=-sample_step;
+          voice->sample_speed=-voice->sample_speed;
         }
         else
           sample_pos-=sample_loop_len;
       }
     } while(buf<buffer_end);
-    channel->sample_pos=sample_pos+sample_pos_offs;
-  } while(++channel!=channel_end);
+    voice->sample_pos=sample_pos+sample_pos_offs;
+#if PMF_USE_RESONANT_FILTERS==1
+    voice->filter_hist[0]=filter_hist[0];
+    voice->filter_hist[1]=filter_hist[1];
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+    voice->meter_peak=meter_peak;
+    voice->meter_sum_sq=meter_sum_sq;
+#endif
+  } while(++voice!=voice_end);
 
   // advance buffer
   ((T*&)buf_.begin)+=num_samples_*(stereo?2:1);
+#if PMF_USE_ECHO==1
+  ((T*&)buf_.echo_send)+=num_samples_*(stereo?2:1);
+#endif
   buf_.num_samples-=num_samples_;
 }
+//----
+
+template<bool stereo, unsigned channel_bits>
+void pmf_player::mix_buffer_float_impl(pmf_mixer_buffer &buf_, unsigned num_samples_, pmf_channel_mask_t channel_mask_)
+{
+  // select the mixing loop for the sample interpolation once for the buffer
+  switch(mixer_interpolation())
+  {
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+    case mixinterp_kernel: mix_voices_float_impl<stereo, channel_bits, mixinterp_kernel>(buf_, num_samples_, channel_mask_); break;
+#endif
+#if PMF_USE_LINEAR_INTERPOLATION==1
+    case mixinterp_linear: mix_voices_float_impl<stereo, channel_bits, mixinterp_linear>(buf_, num_samples_, channel_mask_); break;
+#endif
+    default: mix_voices_float_impl<stereo, channel_bits, mixinterp_none>(buf_, num_samples_, channel_mask_);
+  }
+}
+//----
+
+template<bool stereo, unsigned channel_bits, pmf_player::e_mixer_interpolation interpolation>
+void pmf_player::mix_voices_float_impl(pmf_mixer_buffer &buf_, unsigned num_samples_, pmf_channel_mask_t channel_mask_)
+{
+  // mix voices in channel_mask_ to float buffer (full scale=[-1, 1], channel volume scaled as in mix_buffer_impl() for channel_bits)
+  mixer_voice *voice=m_voices, *voice_end=voice+m_num_playback_channels;
+  pmf_channel_mask_t mix_mask=channel_mix_mask();
+  const sample_pos_t sample_pos_frc_mask=(sample_pos_t(1)<<sample_pos_frc_bits)-1;
+  const float sample_pos_frc_scale=1.0f/float(sample_pos_frc_mask+1);
+  do
+  {
+    // check for active channel
+    bool is_mixed=mix_mask&1, is_included=channel_mask_&1;
+    mix_mask>>=1;
+    channel_mask_>>=1;
+    if(!is_included || !voice->sample_speed)
+      continue;
+
+    // skip mixing of inaudible and muted channels (master volume is folded into the voice volume)
+    uint8_t sample_volume=uint8_t((uint16_t(voice->volume)*m_master_gain)>>8);
+    if(!sample_volume || !is_mixed)
+    {
+      advance_sample_pos(voice->smp_metadata, voice->sample_pos, voice->sample_speed, num_samples_);
+      continue;
+    }
+
+    // get channel attributes
+    size_t sample_addr=(size_t)(m_mix_pmf_file+pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_data));
+    sample_pos_t sample_pos=voice->sample_pos;
+    sample_step_t sample_step=sample_step_t(voice->sample_speed)<<sample_step_shift;
+    sample_pos_t sample_end=sample_pos_t(pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_length))<<sample_pos_frc_bits;
+    sample_pos_t sample_loop_len=sample_pos_t(pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_loop_length_and_panning)&0xffffff)<<sample_pos_frc_bits;
+    sample_pos_t sample_pos_offs=sample_end-sample_loop_len;
+    if(sample_pos<sample_pos_offs)
+      sample_pos_offs=0;
+#if PMF_USE_SAMPLE_MIPMAPS==1
+    // pick octave-down copy of the sample for speeds >1.0 (sample positions stay in full sample resolution)
+    uint8_t sample_pos_shift=sample_pos_frc_bits+select_sample_mip_level(voice->smp_metadata, voice->sample_speed, sample_addr);
+    sample_pos_offs&=sample_pos_t(-1)<<sample_pos_shift;
+#else
+    const uint8_t sample_pos_shift=sample_pos_frc_bits;
+#endif
+    sample_addr+=sample_pos_offs>>sample_pos_shift;
+    sample_pos-=sample_pos_offs;
+    sample_end-=sample_pos_offs;
+
+    // setup voice gain and panning (surround inverts the phase of the right channel)
+    int8_t panning=voice->panning;
+    float gain=float(sample_volume)*(1.0f/float(uint32_t(1)<<(31-channel_bits)));
+    float gain_l=gain*float(128-(panning==-128?0:panning))*(1.0f/256.0f);
+    float gain_r=panning==-128?-gain_l:gain*float(128+panning)*(1.0f/256.0f);
+
+    // setup echo send (panned as the voice)
+#if PMF_USE_ECHO==1
+    float echo_gain=gain*float(m_echo_sends[voice-m_voices])*(1.0f/256.0f);
+    float echo_gain_l=echo_gain*float(128-(panning==-128?0:panning))*(1.0f/256.0f);
+    float echo_gain_r=panning==-128?-echo_gain_l:echo_gain*float(128+panning)*(1.0f/256.0f);
+    float *send=(float*)buf_.echo_send;
+    const bool is_sent=m_echo_sends[voice-m_voices] && m_echo_buffer;
+#else
+    const float echo_gain=0.0f, echo_gain_l=0.0f, echo_gain_r=0.0f;
+    float *send=0;
+    const bool is_sent=false;
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+    const float meter_gain=float(sample_volume)*(1.0f/256.0f);
+    uint16_t meter_peak=voice->meter_peak;
+    uint32_t meter_sum_sq=voice->meter_sum_sq;
+#endif
+
+    // setup resonant filter
+#if PMF_USE_RESONANT_FILTERS==1
+    const float filter_a0=float(voice->filter_coeffs[0])*(1.0f/16777216.0f), filter_b0=float(voice->filter_coeffs[1])*(1.0f/16777216.0f), filter_b1=float(voice->filter_coeffs[2])*(1.0f/16777216.0f);
+    float filter_y1=float(voice->filter_hist[0])*(1.0f/256.0f), filter_y2=float(voice->filter_hist[1])*(1.0f/256.0f);
+    const bool is_filtered=voice->filter_coeffs[0]!=0;
+#else
+    const bool is_filtered=false;
+#endif
+
+    // mix channel to the buffer
+    float *buf=(float*)buf_.begin, *buffer_end=buf+num_samples_*(stereo?2:1);
+    if(!is_filtered && sample_step==sample_step_t(1)<<sample_pos_frc_bits && !(sample_pos&sample_pos_frc_mask) && !(pgm_read_byte(voice->smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop))
+    {
+      // fast path for speed 1.0 (e.g. pitch baked samples): advance one sample byte per output sample
+      const int8_t *smp_addr=(const int8_t*)(sample_addr+size_t(sample_pos>>sample_pos_frc_bits)), *smp_end=(const int8_t*)(sample_addr+size_t(sample_end>>sample_pos_frc_bits));
+      do
+      {
+        float smp=float(*smp_addr);
+#if PMF_USE_CHANNEL_METERS==1
+        update_channel_meter(int16_t(smp*meter_gain), meter_peak, meter_sum_sq);
+#endif
+        if(stereo)
+        {
+          (*buf++)+=gain_l*smp;
+          (*buf++)+=gain_r*smp;
+        }
+        else
+          (*buf++)+=gain*smp;
+        if(is_sent)
+        {
+          if(stereo)
+          {
+            (*send++)+=echo_gain_l*smp;
+            (*send++)+=echo_gain_r*smp;
+          }
+          else
+            (*send++)+=echo_gain*smp;
+        }
+        if(++smp_addr==smp_end)
+        {
+          if(!sample_loop_len)
+          {
+            voice->sample_speed=0;
+            break;
+          }
+          smp_addr-=size_t(sample_loop_len>>sample_pos_frc_bits);
+        }
+      } while(buf<buffer_end);
+      sample_pos=sample_pos_t(smp_addr-(const int8_t*)sample_addr)<<sample_pos_frc_bits;
+    }
+    else
+    do
+    {
+      // get sample data
+      const uint8_t *smp_addr=(const uint8_t*)(sample_addr+(sample_pos>>sample_pos_shift));
+      float smp;
+#if PMF_USE_KERNEL_INTERPOLATION!=0
+      if(interpolation==mixinterp_kernel)
+        smp=float(apply_interpolation_kernel(smp_addr, uint8_t(sample_pos>>(sample_pos_shift-8))))*(1.0f/16384.0f);
+      else
+#endif
+      {
+        smp=float(int8_t(pgm_read_byte(smp_addr)));
+        if(interpolation==mixinterp_linear)
+          smp+=(float(int8_t(pgm_read_byte(smp_addr+1)))-smp)*(float((sample_pos>>(sample_pos_shift-sample_pos_frc_bits))&sample_pos_frc_mask)*sample_pos_frc_scale);
+      }
+#if PMF_USE_RESONANT_FILTERS==1
+      if(is_filtered)
+      {
+        float res=filter_a0*smp+filter_b0*filter_y1+filter_b1*filter_y2;
+        res=res<-256.0f?-256.0f:res>255.0f?255.0f:res;
+        filter_y2=filter_y1;
+        smp=filter_y1=res;
+      }
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+      update_channel_meter(int16_t(smp*meter_gain), meter_peak, meter_sum_sq);
+#endif
+
+      // mix the result to the audio buffer (the if-branch with compile-time constant will be optimized out)
+      if(stereo)
+      {
+        (*buf++)+=gain_l*smp;
+        (*buf++)+=gain_r*smp;
+      }
+      else
+        (*buf++)+=gain*smp;
+      if(is_sent)
+      {
+        if(stereo)
+        {
+          (*send++)+=echo_gain_l*smp;
+          (*send++)+=echo_gain_r*smp;
+        }
+        else
+          (*send++)+=echo_gain*smp;
+      }
+
+      // advance sample position
+      sample_pos+=sample_step;
+      if(sample_pos>=sample_end)
+      {
+        // check for loop
+        if(!sample_loop_len)
+        {
+          voice->sample_speed=0;
+          break;
+        }
+
+        // apply normal/bidi loop
+        if(pgm_read_byte(voice->smp_metadata+pmfcfg_offset_smp_flags)&pmfsmpflag_bidi_loop)
+        {
+          sample_pos-=sample_step*2;
+          sample_step=-sample_step;
+          voice->sample_speed=-voice->sample_speed;
+        }
+        else
+          sample_pos-=sample_loop_len;
+      }
+    } while(buf<buffer_end);
+    voice->sample_pos=sample_pos+sample_pos_offs;
+#if PMF_USE_RESONANT_FILTERS==1
+    voice->filter_hist[0]=int32_t(filter_y1*256.0f);
+    voice->filter_hist[1]=int32_t(filter_y2*256.0f);
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+    voice->meter_peak=meter_peak;
+    voice->meter_sum_sq=meter_sum_sq;
+#endif
+  } while(++voice!=voice_end);
+
+  // advance buffer
+  ((float*&)buf_.begin)+=num_samples_*(stereo?2:1);
+#if PMF_USE_ECHO==1
+  ((float*&)buf_.echo_send)+=num_samples_*(stereo?2:1);
+#endif
+  buf_.num_samples-=num_samples_;
+}
+//----
+
+template<typename T, bool stereo, unsigned channel_bits>
+void pmf_player::mix_layers_impl(const pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // mix voices of playing layers on top of the buffer (the buffer is advanced by the owner mixing its voices)
+  for(pmf_player *layer=m_next_layer; layer; layer=layer->m_next_layer)
+    if(layer->m_speed)
+    {
+      pmf_mixer_buffer buf=buf_;
+      layer->mix_buffer_impl<T, stereo, channel_bits>(buf, num_samples_);
+    }
+}
+//----
+
+template<bool stereo, unsigned channel_bits>
+void pmf_player::mix_layers_float_impl(const pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // float version of mix_layers_impl()
+  for(pmf_player *layer=m_next_layer; layer; layer=layer->m_next_layer)
+    if(layer->m_speed)
+    {
+      pmf_mixer_buffer buf=buf_;
+      layer->mix_buffer_float_impl<stereo, channel_bits>(buf, num_samples_);
+    }
+}
+//----
+
+#if PMF_USE_ECHO==1
+template<typename T, bool stereo, unsigned channel_bits>
+void pmf_player::apply_echo(const pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // add the delay line to the last num_samples_ mixed samples and feed the echo sends back to the delay line (16-bit delay line with 1 bit headroom)
+  if(!m_echo_buffer)
+    return;
+  enum {delay_shift=15-channel_bits, delay_len=pmfplayer_echo_delay*(stereo?2:1)};
+  T *buf=(T*)buf_.begin-num_samples_*(stereo?2:1), *buffer_end=(T*)buf_.begin;
+  const T *send=(const T*)buf_.echo_send-num_samples_*(stereo?2:1);
+  if(m_echo_pos==unsigned(-1))
+  {
+    memset(m_echo_buffer, 0, sizeof(int16_t)*delay_len);
+    m_echo_pos=0;
+  }
+  int16_t *delay=m_echo_buffer+m_echo_pos, *delay_end=m_echo_buffer+delay_len;
+  int32_t feedback=m_echo_feedback, level=m_echo_level;
+  do
+  {
+    int32_t smp=*delay;
+    (*buf++)+=T((smp*level)>>(8+delay_shift));
+    smp=(int32_t(*send++)<<delay_shift)+((smp*feedback)>>8);
+    *delay=int16_t(smp<-32768?-32768:smp>32767?32767:smp);
+    if(++delay==delay_end)
+      delay=m_echo_buffer;
+  } while(buf<buffer_end);
+  m_echo_pos=unsigned(delay-m_echo_buffer);
+}
+//----
+
+template<bool stereo, unsigned channel_bits>
+void pmf_player::apply_echo_float(const pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // float version of apply_echo() (delay line in the same scale as for mix_buffer_impl() for channel_bits)
+  if(!m_echo_buffer)
+    return;
+  enum {delay_len=pmfplayer_echo_delay*(stereo?2:1)};
+  const float delay_scale=float(uint32_t(1)<<(30-channel_bits)), level=float(m_echo_level)*(1.0f/256.0f)/delay_scale, feedback=float(m_echo_feedback)*(1.0f/256.0f);
+  float *buf=(float*)buf_.begin-num_samples_*(stereo?2:1), *buffer_end=(float*)buf_.begin;
+  const float *send=(const float*)buf_.echo_send-num_samples_*(stereo?2:1);
+  if(m_echo_pos==unsigned(-1))
+  {
+    memset(m_echo_buffer, 0, sizeof(int16_t)*delay_len);
+    m_echo_pos=0;
+  }
+  int16_t *delay=m_echo_buffer+m_echo_pos, *delay_end=m_echo_buffer+delay_len;
+  do
+  {
+    float smp=float(*delay);
+    (*buf++)+=smp*level;
+    smp=(*send++)*delay_scale+smp*feedback;
+    *delay=int16_t(smp<-32768.0f?-32768.0f:smp>32767.0f?32767.0f:smp);
+    if(++delay==delay_end)
+      delay=m_echo_buffer;
+  } while(buf<buffer_end);
+  m_echo_pos=unsigned(delay-m_echo_buffer);
+}
+#endif
 //---------------------------------------------------------------------------
 
 
 //===========================================================================
 // pmf_audio_buffer
 //===========================================================================
-template<typename T, unsigned buffer_size>
+template<typename T, unsigned buffer_size, unsigned sample_bits>
 struct pmf_audio_buffer
 {
   // construction & accessors
   pmf_audio_buffer();
   void reset();
-  template<typename U, unsigned sample_bits> U read_sample();
+  template<typename U, unsigned num_channels=1> U read_sample();
   pmf_mixer_buffer get_mixer_buffer();
+  void convert_subbuffer();
   //-------------------------------------------------------------------------
 
   enum {buf_size=buffer_size};
   enum {subbuf_size=buffer_size/2};
+  enum {sample_range=1<<sample_bits};
   volatile uint16_t playback_pos;
   uint8_t subbuf_write_idx;
+#if PMF_MIXING_RATE_DIVIDER>1
+  uint8_t upsample_step;
+#endif
   T buffer[buffer_size];
+#if PMF_USE_ECHO==1
+  T echo_send[buffer_size/2];
+#endif
 };
 //---------------------------------------------------------------------------
 
-template<typename T, unsigned buffer_size>
-pmf_audio_buffer<T, buffer_size>::pmf_audio_buffer()
+template<typename T, unsigned buffer_size, unsigned sample_bits>
+pmf_audio_buffer<T, buffer_size, sample_bits>::pmf_audio_buffer()
 {
   reset();
 }
 //----
 
-template<typename T, unsigned buffer_size>
-void pmf_audio_buffer<T, buffer_size>::reset()
+template<typename T, unsigned buffer_size, unsigned sample_bits>
+void pmf_audio_buffer<T, buffer_size, sample_bits>::reset()
 {
   playback_pos=0;
   subbuf_write_idx=1;
-  memset(buffer, 0, sizeof(buffer));
+#if PMF_MIXING_RATE_DIVIDER>1
+  upsample_step=0;
+#endif
+  // setup silence for playback (sub-buffers are cleared for mixing in get_mixer_buffer())
+  for(unsigned i=0; i<buffer_size; ++i)
+    buffer[i]=T(sample_range>>1);
 }
 //----
 
-template<typename T, unsigned buffer_size>
-template<typename U, unsigned sample_bits>
-U pmf_audio_buffer<T, buffer_size>::read_sample()
+template<typename T, unsigned buffer_size, unsigned sample_bits>
+template<typename U, unsigned num_channels>
+U pmf_audio_buffer<T, buffer_size, sample_bits>::read_sample()
 {
-  // read sample from the buffer and clip to given number of bits
-  enum {sample_range=1<<sample_bits};
-  enum {max_sample_val=sample_range-1};
+  // read sample (converted by convert_subbuffer()) from the buffer
   uint16_t pbpos=playback_pos;
-  T *smp_addr=buffer+pbpos;
-  U smp=U(*smp_addr+(sample_range>>1));
-  *smp_addr=0;
-  if(smp>sample_range-1)
-    smp=smp>((U(-1)>>1)+(sample_range>>1))?0:max_sample_val;
-  if(++pbpos==buffer_size)
+  const T *smp_addr=buffer+pbpos;
+#if PMF_MIXING_RATE_DIVIDER>1
+  // upsample the mixed buffer by holding/interpolating each frame over multiple reads
+  enum {upsample_shift=PMF_MIXING_RATE_DIVIDER==4?2:1};
+  uint8_t step=upsample_step;
+  T smp=*smp_addr;
+#if PMF_USE_LINEAR_UPSAMPLING==1
+  uint16_t next_pos=pbpos+num_channels;
+  T delta=buffer[next_pos<buffer_size?next_pos:next_pos-buffer_size]-smp;
+  smp+=(delta>>upsample_shift)*step;
+#endif
+  if(!(++pbpos%num_channels))
+  {
+    if(++step<PMF_MIXING_RATE_DIVIDER)
+      pbpos-=num_channels;
+    else
+      step=0;
+    upsample_step=step;
+  }
+#else
+  T smp=*smp_addr;
+  ++pbpos;
+#endif
+  if(pbpos==buffer_size)
     pbpos=0;
   playback_pos=pbpos;
-  return smp;
+  return U(smp);
 }
 //----
 
-template<typename T, unsigned buffer_size>
-pmf_mixer_buffer pmf_audio_buffer<T, buffer_size>::get_mixer_buffer()
+template<typename T, unsigned buffer_size, unsigned sample_bits>
+pmf_mixer_buffer pmf_audio_buffer<T, buffer_size, sample_bits>::get_mixer_buffer()
 {
   // return buffer for mixing if available (i.e. not playing the one for writing)
   uint16_t pbpos=playback_pos; // note: atomic read thus no need to disable interrupts
@@ -445,9 +1449,55 @@ pmf_mixer_buffer pmf_audio_buffer<T, buffer_size>::get_mixer_buffer()
     return buf;
   buf.begin=buffer+subbuf_write_idx*subbuf_size;
   buf.num_samples=subbuf_size;
+  memset(buf.begin, 0, sizeof(T)*subbuf_size);
+#if PMF_USE_ECHO==1
+  buf.echo_send=echo_send;
+  memset(echo_send, 0, sizeof(echo_send));
+#endif
   subbuf_write_idx^=1;
   return buf;
 }
+//----
+
+template<typename T, unsigned buffer_size, unsigned sample_bits>
+void pmf_audio_buffer<T, buffer_size, sample_bits>::convert_subbuffer()
+{
+  // clip the last mixed sub-buffer to the number of DAC bits and convert to unsigned samples for playback
+  enum {min_sample_val=-(sample_range>>1), max_sample_val=(sample_range>>1)-1};
+  T *smp=buffer+(subbuf_write_idx^1)*subbuf_size, *smp_end=smp+subbuf_size;
+#if defined(__ARM_FEATURE_SIMD32)
+  if(sizeof(T)==2 && sample_bits<16)
+  {
+    // clip and bias two 16-bit samples at a time with ARM DSP instructions
+    uint32_t *smp2=(uint32_t*)smp, *smp2_end=(uint32_t*)smp_end;
+    do
+    {
+      uint32_t v;
+      asm("ssat16 %0, %1, %2" : "=r" (v) : "I" (sample_bits), "r" (*smp2));
+      asm("sadd16 %0, %1, %2" : "=r" (*smp2) : "r" (v), "r" (uint32_t(sample_range>>1)*0x10001));
+    } while(++smp2!=smp2_end);
+    return;
+  }
+#endif
+#if defined(__ARM_FEATURE_SAT)
+  {
+    // clip samples with ARM saturation instruction
+    do
+    {
+      int32_t v;
+      asm("ssat %0, %1, %2" : "=r" (v) : "I" (sample_bits), "r" (int32_t(*smp)));
+      *smp=T(v+(sample_range>>1));
+    } while(++smp!=smp_end);
+    return;
+  }
+#endif
+  do
+  {
+    T v=*smp;
+    v=v<T(min_sample_val)?T(min_sample_val):v>T(max_sample_val)?T(max_sample_val):v;
+    *smp=T(v+(sample_range>>1));
+  } while(++smp!=smp_end);
+}
 //---------------------------------------------------------------------------
 
 //============================================================================
@@ -15,6 +15,7 @@ static const uint8_t PROGMEM s_pmf_file[]=
 //============================================================================
 static pmf_player s_player;
 static unsigned s_effect_channel=0;
+static bool s_sfx_demo=false;
 //----------------------------------------------------------------------------
 
 
@@ -96,7 +97,20 @@ void setup()
   s_player.set_row_callback(&row_callback_test); // setup row callback for the effect
 */
 
-  s_player.start(22050);
+/*
+  // Uncomment this code block to demo sound effects. The code adds 2 extra channels to Aryx for sound effects and plays a drum every second in loop()
+  s_player.enable_playback_channels(s_player.num_playback_channels()+2);
+  s_player.enable_sfx_channels(2);
+  s_sfx_demo=true;
+*/
+
+  // start playback at the highest sampling frequency the MCU can sustain for the music (leaving 25% CPU for the sketch)
+#ifdef ARDUINO_ARCH_AVR
+  static const uint32_t s_sampling_freqs[]={11025, 16000, 22050}; // the calibration excludes the playback interrupt, which alone keeps AVR below 32kHz
+#else
+  static const uint32_t s_sampling_freqs[]={11025, 16000, 22050, 32000, 44100};
+#endif
+  s_player.start(s_player.calibrate_sampling_freq(s_sampling_freqs, sizeof(s_sampling_freqs)/sizeof(*s_sampling_freqs), 25));
 }
 //----------------------------------------------------------------------------
 
@@ -107,5 +121,14 @@ void setup()
 void loop()
 {
   s_player.update(); // keep updating the audio buffer...
+  if(s_sfx_demo)
+  {
+    static unsigned long s_sfx_time=0;
+    if(millis()-s_sfx_time>=1000)
+    {
+      s_player.play_sfx(2, 5*12); // sample 2 at C-5 (the channel playing the oldest effect is stolen if all SFX channels are busy)
+      s_sfx_time=millis();
+    }
+  }
 }
 //----------------------------------------------------------------------------
@@ -30,13 +30,28 @@
 #include "pmf_player.h"
 #if defined(ARDUINO_ARCH_AVR)
 #include "pmf_data.h"
+#if PMF_USE_WIDE_SAMPLE_POS==1
+#error Wide sample position (PMF_USE_WIDE_SAMPLE_POS) is not supported by the AVR mixer
+#endif
+#if PMF_USE_SAMPLE_MIPMAPS==1
+#error Sample mipmaps (PMF_USE_SAMPLE_MIPMAPS) are not supported by the AVR mixer
+#endif
+#if PMF_USE_RESONANT_FILTERS==1
+#error Resonant filters (PMF_USE_RESONANT_FILTERS) are not supported by the AVR mixer
+#endif
+#if PMF_USE_CHANNEL_METERS==1
+#error Channel meters (PMF_USE_CHANNEL_METERS) are not supported by the AVR mixer
+#endif
+#if PMF_USE_ECHO==1
+#error Echo (PMF_USE_ECHO) is not supported by the AVR mixer
+#endif
 //---------------------------------------------------------------------------
 
 
 //===========================================================================
 // audio buffer
 //===========================================================================
-static pmf_audio_buffer<int16_t, 400> s_audio_buffer;
+static pmf_audio_buffer<int16_t, 400, 8> s_audio_buffer;
 //---------------------------------------------------------------------------
 
 
@@ -45,7 +60,7 @@ static pmf_audio_buffer<int16_t, 400> s_audio_buffer;
 //===========================================================================
 ISR(TIMER1_COMPA_vect)
 {
-  PORTD=(uint8_t)s_audio_buffer.read_sample<uint16_t, 8>();
+  PORTD=s_audio_buffer.read_sample<uint8_t>();
 }
 //----
 
@@ -76,22 +91,48 @@ void pmf_player::stop_playback()
 
 void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
 {
+  // mix playing layers and voices of the player, and convert the buffer for playback once fully mixed
+  for(pmf_player *layer=m_next_layer; layer; layer=layer->m_next_layer)
+    if(layer->m_speed)
+    {
+      pmf_mixer_buffer buf=buf_;
+      layer->mix_samples(buf, num_samples_);
+    }
+  mix_samples(buf_, num_samples_);
+  if(!buf_.num_samples)
+    s_audio_buffer.convert_subbuffer();
+}
+//----
+
+void pmf_player::mix_samples(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // mix voices of the player
   int16_t *buffer_begin=(int16_t*)buf_.begin, *buffer_end=buffer_begin+num_samples_;
-  audio_channel *channel=m_channels, *channel_end=channel+m_num_playback_channels;
+  mixer_voice *voice=m_voices, *voice_end=voice+m_num_playback_channels;
+  pmf_channel_mask_t mix_mask=channel_mix_mask();
   do
   {
     // check for active channel
-    if(!channel->sample_speed)
+    bool is_mixed=mix_mask&1;
+    mix_mask>>=1;
+    if(!voice->sample_speed)
+      continue;
+
+    // skip mixing of inaudible and muted channels (master volume is folded into the voice volume)
+    uint8_t volume=uint8_t((uint16_t(voice->volume)*m_master_gain)>>9);
+    if(!volume || !is_mixed)
+    {
+      advance_sample_pos(voice->smp_metadata, voice->sample_pos, voice->sample_speed, num_samples_);
       continue;
+    }
 
     // get channel attributes
-    size_t sample_addr=(size_t)(m_pmf_file+pgm_read_dword(channel->smp_metadata+pmfcfg_offset_smp_data));
-    uint16_t sample_len=pgm_read_word(channel->smp_metadata+pmfcfg_offset_smp_length);/*todo: should be dword*/
-    uint16_t loop_len=pgm_read_word(channel->smp_metadata+pmfcfg_offset_smp_loop_length_and_panning);/*todo: should be dword*/
-    uint8_t volume=(uint16_t(channel->sample_volume)*(channel->vol_env.value>>9))>>8;
-    register uint8_t sample_pos_frc=channel->sample_pos;
-    register uint16_t sample_pos_int=sample_addr+(channel->sample_pos>>8);
-    register uint16_t sample_speed=channel->sample_speed;
+    size_t sample_addr=(size_t)(m_mix_pmf_file+pgm_read_dword(voice->smp_metadata+pmfcfg_offset_smp_data));
+    uint16_t sample_len=pgm_read_word(voice->smp_metadata+pmfcfg_offset_smp_length);/*todo: should be dword*/
+    uint16_t loop_len=pgm_read_word(voice->smp_metadata+pmfcfg_offset_smp_loop_length_and_panning);/*todo: should be dword*/
+    register uint8_t sample_pos_frc=voice->sample_pos;
+    register uint16_t sample_pos_int=sample_addr+(voice->sample_pos>>8);
+    register uint16_t sample_speed=voice->sample_speed;
     register uint16_t sample_end=sample_addr+sample_len;
     register uint16_t sample_loop_len=loop_len;
     register uint8_t sample_volume=volume;
@@ -154,10 +195,10 @@ void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
       ,[buffer_end] "l" (buffer_end)
     );
 
-    // store values back to the channel data
-    channel->sample_pos=(long(sample_pos_int-sample_addr)<<8)+sample_pos_frc;
-    channel->sample_speed=sample_speed;
-  } while(++channel!=channel_end);
+    // store values back to the voice
+    voice->sample_pos=(long(sample_pos_int-sample_addr)<<8)+sample_pos_frc;
+    voice->sample_speed=sample_speed;
+  } while(++voice!=voice_end);
 
   // advance buffer
   ((int16_t*&)buf_.begin)+=num_samples_;
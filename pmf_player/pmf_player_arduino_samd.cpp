@@ -36,7 +36,7 @@
 //===========================================================================
 // audio buffer
 //===========================================================================
-static pmf_audio_buffer<int16_t, 2048> s_audio_buffer;
+static pmf_audio_buffer<int16_t, 2048, 10> s_audio_buffer;
 //---------------------------------------------------------------------------
 
 
@@ -96,7 +96,7 @@ void TC4_Handler()
   if (TC4->COUNT16.INTFLAG.bit.OVF && TC4->COUNT16.INTENSET.bit.OVF)             
   {
     // write 10-bit value from audio buffer to the DAC
-    uint16_t smp=s_audio_buffer.read_sample<uint16_t, 10>();
+    uint16_t smp=s_audio_buffer.read_sample<uint16_t>();
     analogWrite(A0, smp);
 /*#if defined(__SAMD51__)
     while(DAC->SYNCBUSY.bit.DATA0);
@@ -165,6 +165,20 @@ void pmf_player::stop_playback()
 //----
 
 void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  mix_layers_impl<int16_t, false, 8>(buf_, num_samples_);
+  mix_samples(buf_, num_samples_);
+  if(!buf_.num_samples)
+  {
+#if PMF_USE_ECHO==1
+    apply_echo<int16_t, false, 8>(buf_, s_audio_buffer.subbuf_size);
+#endif
+    s_audio_buffer.convert_subbuffer();
+  }
+}
+//----
+
+void pmf_player::mix_samples(pmf_mixer_buffer &buf_, unsigned num_samples_)
 {
   mix_buffer_impl<int16_t, false, 8>(buf_, num_samples_);
 }
@@ -0,0 +1,545 @@
+//============================================================================
+// PMF Player
+//
+// Copyright (c) 2019, Profoundic Technologies, Inc.
+// All rights reserved.
+//----------------------------------------------------------------------------
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Profoundic Technologies nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL PROFOUNDIC TECHNOLOGIES BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//============================================================================
+
+#include "pmf_player.h"
+#if !defined(ARDUINO)
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if PMF_MIXING_RATE_DIVIDER>1
+#error Mixing rate divider (PMF_MIXING_RATE_DIVIDER) is not supported on host
+#endif
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// locals
+//===========================================================================
+namespace
+{
+  enum {host_render_batch_samples=1024};
+  enum {host_channel_bits=13};
+  enum {host_num_output_channels=PMF_USE_STEREO_MIXING?2:1};
+  enum {host_num_accumulators=pmfplayer_host_mixer_threads>1?pmfplayer_host_mixer_threads-1:1};
+#if PMF_USE_FLOAT_MIXING==1
+  typedef float host_mix_t;
+#else
+  typedef int32_t host_mix_t;
+#endif
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // mixer_thread_pool
+  //=========================================================================
+  class mixer_thread_pool
+  {
+  public:
+    typedef void(*job_func_t)(void *data_, unsigned job_idx_);
+    // construction and job execution
+    mixer_thread_pool();
+    ~mixer_thread_pool();
+    void run(job_func_t, void *data_, unsigned num_jobs_);
+    //-----------------------------------------------------------------------
+
+  private:
+    void worker(unsigned job_idx_);
+    //-----------------------------------------------------------------------
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start_cond;
+    std::condition_variable m_done_cond;
+    job_func_t m_job_func;
+    void *m_job_data;
+    unsigned m_num_jobs;
+    unsigned m_num_pending_jobs;
+    unsigned m_generation;
+    bool m_exit;
+  };
+  //-------------------------------------------------------------------------
+
+  mixer_thread_pool::mixer_thread_pool()
+  {
+    m_job_func=0;
+    m_job_data=0;
+    m_num_jobs=0;
+    m_num_pending_jobs=0;
+    m_generation=0;
+    m_exit=false;
+  }
+  //----
+
+  mixer_thread_pool::~mixer_thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_exit=true;
+    }
+    m_start_cond.notify_all();
+    for(size_t ti=0; ti<m_threads.size(); ++ti)
+      m_threads[ti].join();
+  }
+  //----
+
+  void mixer_thread_pool::run(job_func_t func_, void *data_, unsigned num_jobs_)
+  {
+    // start worker threads on the first use
+    if(m_threads.empty())
+      for(unsigned ti=1; ti<pmfplayer_host_mixer_threads; ++ti)
+        m_threads.push_back(std::thread(&mixer_thread_pool::worker, this, ti));
+
+    // run jobs [1, num_jobs_) on the worker threads and job 0 on the calling thread
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_job_func=func_;
+      m_job_data=data_;
+      m_num_jobs=num_jobs_;
+      m_num_pending_jobs=num_jobs_-1;
+      ++m_generation;
+    }
+    m_start_cond.notify_all();
+    func_(data_, 0);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_num_pending_jobs)
+      m_done_cond.wait(lock);
+  }
+  //----
+
+  void mixer_thread_pool::worker(unsigned job_idx_)
+  {
+    unsigned generation=0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+      // wait for new jobs
+      while(!m_exit && m_generation==generation)
+        m_start_cond.wait(lock);
+      if(m_exit)
+        return;
+      generation=m_generation;
+      if(job_idx_>=m_num_jobs)
+        continue;
+
+      // run the job
+      job_func_t func=m_job_func;
+      void *data=m_job_data;
+      lock.unlock();
+      (*func)(data, job_idx_);
+      lock.lock();
+      if(!--m_num_pending_jobs)
+        m_done_cond.notify_one();
+    }
+  }
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // accumulate_samples
+  //=========================================================================
+#if PMF_USE_FLOAT_MIXING==1
+  void accumulate_samples(float *dst_, const float *src_, unsigned num_values_)
+  {
+    unsigned i=0;
+#if defined(__SSE2__)
+    // add 8 samples at a time
+    for(; i+8<=num_values_; i+=8)
+    {
+      _mm_storeu_ps(dst_+i, _mm_add_ps(_mm_loadu_ps(dst_+i), _mm_loadu_ps(src_+i)));
+      _mm_storeu_ps(dst_+i+4, _mm_add_ps(_mm_loadu_ps(dst_+i+4), _mm_loadu_ps(src_+i+4)));
+    }
+#endif
+    for(; i<num_values_; ++i)
+      dst_[i]+=src_[i];
+  }
+#else
+  void accumulate_samples(int32_t *dst_, const int32_t *src_, unsigned num_values_)
+  {
+    unsigned i=0;
+#if defined(__SSE2__)
+    // add 8 samples at a time
+    for(; i+8<=num_values_; i+=8)
+    {
+      _mm_storeu_si128((__m128i*)(dst_+i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(dst_+i)), _mm_loadu_si128((const __m128i*)(src_+i))));
+      _mm_storeu_si128((__m128i*)(dst_+i+4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(dst_+i+4)), _mm_loadu_si128((const __m128i*)(src_+i+4))));
+    }
+#endif
+    for(; i<num_values_; ++i)
+      dst_[i]+=src_[i];
+  }
+#endif
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // sample conversion
+  //=========================================================================
+#if PMF_USE_FLOAT_MIXING==1
+  void convert_samples(int16_t *dst_, const float *src_, unsigned num_values_)
+  {
+    unsigned i=0;
+#if defined(__SSE2__)
+    // convert and saturate 8 samples at a time
+    const __m128 scale=_mm_set1_ps(32768.0f);
+    for(; i+8<=num_values_; i+=8)
+    {
+      __m128i v0=_mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src_+i), scale));
+      __m128i v1=_mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src_+i+4), scale));
+      _mm_storeu_si128((__m128i*)(dst_+i), _mm_packs_epi32(v0, v1));
+    }
+#endif
+    for(; i<num_values_; ++i)
+    {
+      float v=src_[i]*32768.0f;
+      dst_[i]=int16_t(lrintf(v<-32768.0f?-32768.0f:v>32767.0f?32767.0f:v));
+    }
+  }
+  //----
+
+  void convert_samples(float *dst_, const float *src_, unsigned num_values_)
+  {
+    if(dst_!=src_)
+      memcpy(dst_, src_, sizeof(float)*num_values_);
+  }
+#else
+  void convert_samples(int16_t *dst_, const int32_t *src_, unsigned num_values_)
+  {
+    for(unsigned i=0; i<num_values_; ++i)
+    {
+      int32_t v=src_[i];
+      dst_[i]=int16_t(v<-32768?-32768:v>32767?32767:v);
+    }
+  }
+  //----
+
+  void convert_samples(float *dst_, const int32_t *src_, unsigned num_values_)
+  {
+    for(unsigned i=0; i<num_values_; ++i)
+      dst_[i]=float(src_[i])*(1.0f/32768.0f);
+  }
+#endif
+} // namespace <anonymous>
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// pmf_host_mixer
+//===========================================================================
+struct pmf_host_mixer
+{
+  pmf_host_mixer();
+  //-------------------------------------------------------------------------
+
+  mixer_thread_pool pool;
+  host_mix_t buffer[host_render_batch_samples*host_num_output_channels];
+  host_mix_t accumulators[host_num_accumulators][host_render_batch_samples*host_num_output_channels];
+  host_mix_t *buffer_begin;
+  unsigned num_buffer_samples;
+#if PMF_USE_ECHO==1
+  host_mix_t echo_send_buffer[host_render_batch_samples*host_num_output_channels];
+  host_mix_t echo_send_accumulators[host_num_accumulators][host_render_batch_samples*host_num_output_channels];
+#endif
+};
+//---------------------------------------------------------------------------
+
+pmf_host_mixer::pmf_host_mixer()
+{
+  buffer_begin=buffer;
+  num_buffer_samples=0;
+}
+//---------------------------------------------------------------------------
+
+namespace
+{
+  //=========================================================================
+  // mix_target
+  //=========================================================================
+  inline host_mix_t *mix_target(pmf_host_mixer&, host_mix_t *samples_)
+  {
+    // mix directly to the output in the mixing format
+    return samples_;
+  }
+  //----
+
+  template<typename T>
+  inline host_mix_t *mix_target(pmf_host_mixer &mixer_, T*)
+  {
+    return mixer_.buffer;
+  }
+  //-------------------------------------------------------------------------
+
+  //=========================================================================
+  // render_samples
+  //=========================================================================
+  template<typename T>
+  void render_samples(pmf_player &player_, pmf_host_mixer &mixer_, T *samples_, unsigned num_samples_)
+  {
+    // mix batches of samples (interleaved for stereo) and convert to the output format
+    while(num_samples_)
+    {
+      unsigned num_samples=min(num_samples_, unsigned(host_render_batch_samples));
+      unsigned num_values=num_samples*host_num_output_channels;
+      if(player_.is_playing())
+      {
+        host_mix_t *mix_buf=mix_target(mixer_, samples_);
+        memset(mix_buf, 0, sizeof(host_mix_t)*num_values);
+#if PMF_USE_ECHO==1
+        memset(mixer_.echo_send_buffer, 0, sizeof(host_mix_t)*num_values);
+#endif
+        mixer_.buffer_begin=mix_buf;
+        mixer_.num_buffer_samples=num_samples;
+        player_.update();
+        convert_samples(samples_, mix_buf, num_values);
+      }
+      else
+        memset(samples_, 0, sizeof(T)*num_values);
+      samples_+=num_values;
+      num_samples_-=num_samples;
+    }
+  }
+} // namespace <anonymous>
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// micros
+//===========================================================================
+uint32_t micros()
+{
+  return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+//---------------------------------------------------------------------------
+
+
+//===========================================================================
+// pmf_player
+//===========================================================================
+void pmf_player::render(int16_t *samples_, unsigned num_samples_)
+{
+  render_samples(*this, get_host_mixer(), samples_, num_samples_);
+}
+//----
+
+void pmf_player::render(float *samples_, unsigned num_samples_)
+{
+  // render samples without clipping
+  render_samples(*this, get_host_mixer(), samples_, num_samples_);
+}
+//---------------------------------------------------------------------------
+
+uint32_t pmf_player::get_sampling_freq(uint32_t sampling_freq_) const
+{
+  return sampling_freq_;
+}
+//----
+
+void pmf_player::start_playback(uint32_t)
+{
+  get_host_mixer().num_buffer_samples=0;
+}
+//----
+
+void pmf_player::stop_playback()
+{
+  get_host_mixer().num_buffer_samples=0;
+}
+//----
+
+void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // mix playing layers and voices of the player, and apply echo once the batch is fully mixed
+  enum {stereo=PMF_USE_STEREO_MIXING?true:false};
+#if PMF_USE_FLOAT_MIXING==1
+  mix_layers_float_impl<stereo, host_channel_bits>(buf_, num_samples_);
+#else
+  mix_layers_impl<int32_t, stereo, host_channel_bits>(buf_, num_samples_);
+#endif
+  mix_samples(buf_, num_samples_);
+#if PMF_USE_ECHO==1 && PMF_USE_FLOAT_MIXING==1
+  if(!buf_.num_samples)
+    apply_echo_float<stereo, host_channel_bits>(buf_, unsigned((host_mix_t*)buf_.begin-m_host_mixer->buffer_begin)/host_num_output_channels);
+#elif PMF_USE_ECHO==1
+  if(!buf_.num_samples)
+    apply_echo<int32_t, stereo, host_channel_bits>(buf_, unsigned((host_mix_t*)buf_.begin-m_host_mixer->buffer_begin)/host_num_output_channels);
+#endif
+}
+//----
+
+void pmf_player::mix_samples(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  // estimate mixing cost of audible channels (samples to mix before the end of non-looping samples)
+  enum {stereo=PMF_USE_STEREO_MIXING?true:false};
+  uint8_t channel_indices[pmfplayer_max_channels];
+  uint32_t channel_costs[pmfplayer_max_channels];
+  uint8_t num_audible_channels=0;
+  pmf_channel_mask_t mix_mask=channel_mix_mask();
+  for(uint8_t ci=0; ci<m_num_playback_channels; ++ci)
+  {
+    const mixer_voice &voice=m_voices[ci];
+    if(!voice.sample_speed || !voice.volume || !((mix_mask>>ci)&1))
+      continue;
+    uint32_t cost=num_samples_;
+    if(!(pgm_read_dword(voice.smp_metadata+pmfcfg_offset_smp_loop_length_and_panning)&0xffffff) && voice.sample_speed>0)
+    {
+      sample_pos_t sample_end=sample_pos_t(pgm_read_dword(voice.smp_metadata+pmfcfg_offset_smp_length))<<sample_pos_frc_bits;
+      sample_pos_t num_left=sample_end>voice.sample_pos?(sample_end-voice.sample_pos)/(sample_pos_t(voice.sample_speed)<<sample_step_shift)+1:1;
+      if(num_left<cost)
+        cost=uint32_t(num_left);
+    }
+
+    // insert the channel to the list sorted by descending cost
+    uint8_t idx=num_audible_channels++;
+    for(; idx && channel_costs[idx-1]<cost; --idx)
+    {
+      channel_indices[idx]=channel_indices[idx-1];
+      channel_costs[idx]=channel_costs[idx-1];
+    }
+    channel_indices[idx]=ci;
+    channel_costs[idx]=cost;
+  }
+
+  // mix on the calling thread only if there isn't enough work for multiple threads
+  pmf_host_mixer &mixer=get_host_mixer();
+  unsigned num_jobs=min(unsigned(pmfplayer_host_mixer_threads), unsigned(num_audible_channels/pmfplayer_host_thread_channels));
+  if(num_jobs<2)
+  {
+#if PMF_USE_FLOAT_MIXING==1
+    mix_buffer_float_impl<stereo, host_channel_bits>(buf_, num_samples_);
+#else
+    mix_buffer_impl<int32_t, stereo, host_channel_bits>(buf_, num_samples_);
+#endif
+    return;
+  }
+
+  // assign channels to jobs, the most expensive first to the least loaded job (inaudible channels are mixed by job 0)
+  struct mix_job
+  {
+    pmf_player *player;
+    pmf_host_mixer *mixer;
+    pmf_mixer_buffer *buffer;
+    unsigned num_samples;
+    pmf_channel_mask_t channel_masks[pmfplayer_host_mixer_threads];
+  } job;
+  uint32_t job_costs[pmfplayer_host_mixer_threads]={0};
+  job.player=this;
+  job.mixer=&mixer;
+  job.buffer=&buf_;
+  job.num_samples=num_samples_;
+  job.channel_masks[0]=pmf_channel_mask_t(-1);
+  for(unsigned ji=1; ji<num_jobs; ++ji)
+    job.channel_masks[ji]=0;
+  for(uint8_t i=0; i<num_audible_channels; ++i)
+  {
+    unsigned job_idx=0;
+    for(unsigned ji=1; ji<num_jobs; ++ji)
+      if(job_costs[ji]<job_costs[job_idx])
+        job_idx=ji;
+    job_costs[job_idx]+=channel_costs[i];
+    if(job_idx)
+    {
+      pmf_channel_mask_t channel_bit=pmf_channel_mask_t(1)<<channel_indices[i];
+      job.channel_masks[job_idx]|=channel_bit;
+      job.channel_masks[0]&=~channel_bit;
+    }
+  }
+
+  // mix job 0 directly to the buffer and other jobs to private accumulators
+  host_mix_t *buf=(host_mix_t*)buf_.begin;
+#if PMF_USE_ECHO==1
+  host_mix_t *send=(host_mix_t*)buf_.echo_send;
+#endif
+  mixer.pool.run([](void *data_, unsigned job_idx_)
+                   {
+                     mix_job &job=*static_cast<mix_job*>(data_);
+                     pmf_mixer_buffer accum;
+                     accum.begin=job_idx_?job.mixer->accumulators[job_idx_-1]:0;
+                     accum.num_samples=job.num_samples;
+                     if(job_idx_)
+                       memset(accum.begin, 0, sizeof(host_mix_t)*job.num_samples*host_num_output_channels);
+#if PMF_USE_ECHO==1
+                     accum.echo_send=job_idx_?job.mixer->echo_send_accumulators[job_idx_-1]:0;
+                     if(job_idx_)
+                       memset(accum.echo_send, 0, sizeof(host_mix_t)*job.num_samples*host_num_output_channels);
+#endif
+                     pmf_mixer_buffer &job_buf=job_idx_?accum:*job.buffer;
+#if PMF_USE_FLOAT_MIXING==1
+                     job.player->mix_buffer_float_impl<stereo, host_channel_bits>(job_buf, job.num_samples, job.channel_masks[job_idx_]);
+#else
+                     job.player->mix_buffer_impl<int32_t, stereo, host_channel_bits>(job_buf, job.num_samples, job.channel_masks[job_idx_]);
+#endif
+                   }, &job, num_jobs);
+
+  // sum the accumulators to the buffer
+  unsigned num_values=num_samples_*host_num_output_channels;
+  for(unsigned ji=1; ji<num_jobs; ++ji)
+  {
+    accumulate_samples(buf, mixer.accumulators[ji-1], num_values);
+#if PMF_USE_ECHO==1
+    accumulate_samples(send, mixer.echo_send_accumulators[ji-1], num_values);
+#endif
+  }
+}
+//----
+
+pmf_mixer_buffer pmf_player::get_mixer_buffer()
+{
+  // return the buffer pending for mixing in render()
+  pmf_host_mixer &mixer=get_host_mixer();
+  pmf_mixer_buffer buf;
+  buf.begin=mixer.buffer_begin;
+  buf.num_samples=mixer.num_buffer_samples;
+#if PMF_USE_ECHO==1
+  buf.echo_send=mixer.echo_send_buffer;
+#endif
+  mixer.num_buffer_samples=0;
+  return buf;
+}
+//----
+
+pmf_host_mixer &pmf_player::get_host_mixer()
+{
+  // allocate render buffers and mixer threads of the player on the first use
+  if(!m_host_mixer)
+    m_host_mixer=new pmf_host_mixer;
+  return *m_host_mixer;
+}
+//----
+
+void pmf_player::release_host_mixer()
+{
+  delete m_host_mixer;
+  m_host_mixer=0;
+}
+//---------------------------------------------------------------------------
+
+//===========================================================================
+#endif // !ARDUINO
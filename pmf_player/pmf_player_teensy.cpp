@@ -48,13 +48,15 @@ public:
   ~mod_audio_stream();
   void init(AudioStream &output_, bool stereo_=true);
   pmf_mixer_buffer get_mixer_buffer();
+  unsigned num_subbuffer_samples() const;
+  void convert_mixer_buffer();
   //-------------------------------------------------------------------------
 
 private:
   virtual void update();
   //-------------------------------------------------------------------------
   
-  pmf_audio_buffer<int32_t, 2048> m_audio_buffer;
+  pmf_audio_buffer<int32_t, 2048, 16> m_audio_buffer;
   AudioConnection *m_connection_l, *m_connection_r;
   bool m_stereo;
 };
@@ -92,6 +94,18 @@ pmf_mixer_buffer mod_audio_stream::get_mixer_buffer()
     buf.num_samples/=2;
   return buf;
 }
+//----
+
+unsigned mod_audio_stream::num_subbuffer_samples() const
+{
+  return m_stereo?m_audio_buffer.subbuf_size/2:m_audio_buffer.subbuf_size;
+}
+//----
+
+void mod_audio_stream::convert_mixer_buffer()
+{
+  m_audio_buffer.convert_subbuffer();
+}
 //---------------------------------------------------------------------------
 
 void mod_audio_stream::update()
@@ -103,9 +117,9 @@ void mod_audio_stream::update()
     int16_t *data_l=block_l->data, *data_r=block_r->data;
     for(unsigned i=0; i<AUDIO_BLOCK_SAMPLES; ++i)
     {
-      uint16_t vl=m_audio_buffer.read_sample<uint16_t, 16>();
+      uint16_t vl=m_audio_buffer.read_sample<uint16_t, 2>();
       data_l[i]=vl-32768;
-      uint16_t vr=m_audio_buffer.read_sample<uint16_t, 16>();
+      uint16_t vr=m_audio_buffer.read_sample<uint16_t, 2>();
       data_r[i]=vr-32768;
     }
     transmit(block_l, 0);
@@ -119,7 +133,7 @@ void mod_audio_stream::update()
     int16_t *data=block->data;
     for(unsigned i=0; i<AUDIO_BLOCK_SAMPLES; ++i)
     {
-      uint16_t v=m_audio_buffer.read_sample<uint16_t, 16>();
+      uint16_t v=m_audio_buffer.read_sample<uint16_t>();
       data[i]=v-32768;
     }
     transmit(block, 0);
@@ -160,6 +174,20 @@ void pmf_player::stop_playback()
 //----
 
 void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  mix_layers_impl<int32_t, PMF_USE_STEREO_MIXING?true:false, 13>(buf_, num_samples_);
+  mix_samples(buf_, num_samples_);
+  if(!buf_.num_samples)
+  {
+#if PMF_USE_ECHO==1
+    apply_echo<int32_t, PMF_USE_STEREO_MIXING?true:false, 13>(buf_, s_mod_stream.num_subbuffer_samples());
+#endif
+    s_mod_stream.convert_mixer_buffer();
+  }
+}
+//----
+
+void pmf_player::mix_samples(pmf_mixer_buffer &buf_, unsigned num_samples_)
 {
   mix_buffer_impl<int32_t, PMF_USE_STEREO_MIXING?true:false, 13>(buf_, num_samples_);
 }
@@ -175,17 +203,20 @@ pmf_mixer_buffer pmf_player::get_mixer_buffer()
 //===========================================================================
 // pmf_player
 //===========================================================================
-static pmf_audio_buffer<int16_t, 2048> s_audio_buffer;
+static pmf_audio_buffer<int16_t, 2048, 12> s_audio_buffer;
 static IntervalTimer s_int_timer;
 //----
 
 void playback_interrupt()
 {
-  uint16_t smp0=s_audio_buffer.read_sample<uint16_t, 12>();
-  analogWriteDAC0(smp0);
 #if PMF_USE_STEREO_MIXING==1
-  uint16_t smp1=s_audio_buffer.read_sample<uint16_t, 12>();
+  uint16_t smp0=s_audio_buffer.read_sample<uint16_t, 2>();
+  analogWriteDAC0(smp0);
+  uint16_t smp1=s_audio_buffer.read_sample<uint16_t, 2>();
   analogWriteDAC1(smp1); // if you get compilation error here, your Teensy board doesn't have two DAC's for stereo output. Disable stereo output by setting "PMF_USE_STEREO_MIXING 0" in pmf_player.h
+#else
+  uint16_t smp0=s_audio_buffer.read_sample<uint16_t>();
+  analogWriteDAC0(smp0);
 #endif
 }
 //----
@@ -215,6 +246,20 @@ void pmf_player::stop_playback()
 //----
 
 void pmf_player::mix_buffer(pmf_mixer_buffer &buf_, unsigned num_samples_)
+{
+  mix_layers_impl<int16_t, PMF_USE_STEREO_MIXING?true:false, PMF_USE_STEREO_MIXING?9:8>(buf_, num_samples_);
+  mix_samples(buf_, num_samples_);
+  if(!buf_.num_samples)
+  {
+#if PMF_USE_ECHO==1
+    apply_echo<int16_t, PMF_USE_STEREO_MIXING?true:false, PMF_USE_STEREO_MIXING?9:8>(buf_, s_audio_buffer.subbuf_size/(PMF_USE_STEREO_MIXING?2:1));
+#endif
+    s_audio_buffer.convert_subbuffer();
+  }
+}
+//----
+
+void pmf_player::mix_samples(pmf_mixer_buffer &buf_, unsigned num_samples_)
 {
   mix_buffer_impl<int16_t, PMF_USE_STEREO_MIXING?true:false, PMF_USE_STEREO_MIXING?9:8>(buf_, num_samples_);
 }